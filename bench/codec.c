@@ -0,0 +1,297 @@
+/*  codec.c - Codec and framing benchmarks for the LIONS Middleware Protocol
+    Copyright (C) 2026 splatte.dev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+// ===============================================================
+// Prints one CSV row per (benchmark, version, payload size) so runs
+// can be diffed between commits:
+//   ./codec > before.csv
+// ===============================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../lib/c/lt_arena.h"
+#include "../lib/c/lt_base.h"
+#include "../lib/c/lmp.h"
+#include "../lib/c/liblmp.h"
+
+#define BENCH_MIN_NS 200000000.0 // run each codec benchmark for at least 200ms
+#define BENCH_BATCH 1024
+#define BENCH_RECV_PACKETS 20000
+
+static const size_t bench_payload_sizes[] = {1, 16, 64, 256, 512, 1024, 1400, LMP_PACKET_PAYLOAD_MAX_SIZE};
+static const lmp_version bench_versions[] = {LMP_VERSION_2, LMP_VERSION_3};
+
+typedef struct {
+    int fd;
+    const u8* frame;
+    size_t frame_size;
+    u32 count;
+} bench_writer_args;
+
+static f64 bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64)ts.tv_sec * 1e9 + (f64)ts.tv_nsec;
+}
+
+static void bench_report(const char* name, lmp_version version, size_t payload_size,
+                         u64 packets, u64 dropped, size_t packet_size, f64 elapsed_ns) {
+    f64 ns_per_packet = packets ? elapsed_ns / (f64)packets : 0;
+    f64 gb_per_s = ((f64)packets * (f64)packet_size) / elapsed_ns;
+
+    printf("%s,%u,%zu,%llu,%llu,%.2f,%.3f\n", name, version, payload_size,
+           (unsigned long long)packets, (unsigned long long)dropped, ns_per_packet, gb_per_s);
+}
+
+static const u8 bench_empty_payload[] = {LMP_PAYLOAD_EMPTY};
+
+// NOTE(laith): a one byte payload has to be the empty payload byte to be valid
+static void bench_packet(lmp_packet* packet, lmp_version version, const u8* payload, size_t size) {
+    if (size == 1) {
+        payload = bench_empty_payload;
+    }
+
+    lmp_packet_init(packet);
+    packet->version = version;
+    packet->type = LMP_TYPE_SEND;
+    packet->arg = LMP_ARG_SEND;
+    packet->payload = payload;
+    packet->payload_length = size;
+}
+
+static void bench_serialize(lmp_version version, const u8* payload, size_t size) {
+    u8 buffer[LMP_PACKET_MAX_SIZE];
+    lmp_packet packet;
+    lmp_result result;
+    bench_packet(&packet, version, payload, size);
+
+    u64 packets = 0;
+    f64 start = bench_now_ns();
+    f64 elapsed = 0;
+
+    while (elapsed < BENCH_MIN_NS) {
+        for (u32 i = 0; i < BENCH_BATCH; i++) {
+            lmp_packet_serialize(buffer, sizeof(buffer), &packet, &result);
+        }
+        packets += BENCH_BATCH;
+        elapsed = bench_now_ns() - start;
+    }
+
+    bench_report("serialize", version, size, packets, 0, result.size, elapsed);
+}
+
+static void bench_serialize_iov(lmp_version version, const u8* payload, size_t size) {
+    u8 header[LMP_PACKET_HEADER_MAX_SIZE];
+    struct iovec iov[LMP_PACKET_IOV_COUNT];
+    lmp_packet packet;
+    lmp_result result;
+    bench_packet(&packet, version, payload, size);
+
+    u64 packets = 0;
+    f64 start = bench_now_ns();
+    f64 elapsed = 0;
+
+    while (elapsed < BENCH_MIN_NS) {
+        for (u32 i = 0; i < BENCH_BATCH; i++) {
+            lmp_packet_serialize_iov(header, iov, &packet, &result);
+        }
+        packets += BENCH_BATCH;
+        elapsed = bench_now_ns() - start;
+    }
+
+    bench_report("serialize_iov", version, size, packets, 0, result.size, elapsed);
+}
+
+static void bench_deserialize(lmp_version version, const u8* payload, size_t size) {
+    u8 buffer[LMP_PACKET_MAX_SIZE];
+    lmp_packet packet;
+    lmp_result result;
+    bench_packet(&packet, version, payload, size);
+    lmp_packet_serialize(buffer, sizeof(buffer), &packet, &result);
+    size_t packet_size = result.size;
+
+    volatile size_t sink = 0;
+    u64 packets = 0;
+    f64 start = bench_now_ns();
+    f64 elapsed = 0;
+
+    while (elapsed < BENCH_MIN_NS) {
+        for (u32 i = 0; i < BENCH_BATCH; i++) {
+            lmp_packet_deserialize(buffer, packet_size, &packet, &result);
+            sink += packet.payload_length;
+        }
+        packets += BENCH_BATCH;
+        elapsed = bench_now_ns() - start;
+    }
+
+    bench_report("deserialize", version, size, packets, 0, packet_size, elapsed);
+}
+
+static void* bench_writer(void* args) {
+    bench_writer_args* a = (bench_writer_args*)args;
+
+    for (u32 i = 0; i < a->count; i++) {
+        size_t sent = 0;
+        while (sent < a->frame_size) {
+            ssize_t n = send(a->fd, a->frame + sent, a->frame_size - sent, 0);
+            if (n <= 0) {
+                shutdown(a->fd, SHUT_WR);
+                return NULL;
+            }
+            sent += n;
+        }
+    }
+
+    shutdown(a->fd, SHUT_WR);
+    return NULL;
+}
+
+// NOTE(laith): the writer pushes packets back to back, the same way a busy client would. any
+// packet the framing loop loses shows up in the dropped column. with_reader swaps
+// lmp_net_recv_packet for a lmp_net_reader on the same socket
+static void bench_recv(lmp_version version, const u8* payload, size_t size, u8 with_reader) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        lmp_log_print("bench", "Failed to create socketpair", LMP_PRINT_TYPE_ERROR);
+        return;
+    }
+
+    u8 frame[LMP_PACKET_MAX_SIZE];
+    lmp_packet packet;
+    lmp_result result;
+    bench_packet(&packet, version, payload, size);
+    lmp_packet_serialize(frame, sizeof(frame), &packet, &result);
+
+    bench_writer_args args = {fds[0], frame, result.size, BENCH_RECV_PACKETS};
+    pthread_t writer;
+
+    f64 start = bench_now_ns();
+    pthread_create(&writer, NULL, bench_writer, &args);
+
+    u8 buffer[LMP_PACKET_MAX_SIZE];
+    mem_arena* arena = arena_create(KiB(16));
+    lmp_net_reader reader;
+    lmp_net_reader_init(&reader, fds[1], arena);
+
+    u64 received = 0;
+    for (;;) {
+        lmp_error error = with_reader
+            ? lmp_net_reader_recv(&reader, &packet, &result)
+            : lmp_net_recv_packet(fds[1], buffer, sizeof(buffer), &packet, &result);
+        if (error == LMP_ERR_BAD_INPUT || error == LMP_ERR_CLOSED) {
+            break;
+        }
+
+        if (error == LMP_ERR_NONE) {
+            received++;
+        }
+    }
+
+    f64 elapsed = bench_now_ns() - start;
+    pthread_join(writer, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    arena_destroy(arena);
+
+    bench_report(with_reader ? "reader" : "recv", version, size, received, BENCH_RECV_PACKETS - received, args.frame_size, elapsed);
+}
+
+static void* bench_drain(void* args) {
+    bench_writer_args* a = (bench_writer_args*)args;
+    u8 buffer[KiB(64)];
+
+    while (recv(a->fd, buffer, sizeof(buffer), 0) > 0) {}
+
+    return NULL;
+}
+
+// NOTE(laith): the same packets written one sendmsg each, then LMP_NET_SEND_BATCH to a sendmsg
+// through lmp_net_send_batch, with another thread draining the other end
+static void bench_send(lmp_version version, const u8* payload, size_t size, u8 batched) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        lmp_log_print("bench", "Failed to create socketpair", LMP_PRINT_TYPE_ERROR);
+        return;
+    }
+
+    static lmp_packet packets[LMP_NET_SEND_BATCH];
+    lmp_result result;
+    for (u32 i = 0; i < LMP_NET_SEND_BATCH; i++) {
+        bench_packet(&packets[i], version, payload, size);
+    }
+
+    bench_writer_args args = {fds[1], NULL, 0, 0};
+    pthread_t drain;
+    pthread_create(&drain, NULL, bench_drain, &args);
+
+    u64 sent = 0;
+    f64 start = bench_now_ns();
+
+    while (sent < BENCH_RECV_PACKETS) {
+        if (batched) {
+            lmp_net_send_batch(fds[0], packets, LMP_NET_SEND_BATCH, &result);
+            sent += result.size;
+        } else {
+            for (u32 i = 0; i < LMP_NET_SEND_BATCH; i++) {
+                lmp_net_send_packet_iov(fds[0], &packets[i], &result);
+            }
+            sent += LMP_NET_SEND_BATCH;
+        }
+    }
+
+    f64 elapsed = bench_now_ns() - start;
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(drain, NULL);
+    close(fds[0]);
+    close(fds[1]);
+
+    bench_report(batched ? "send_batch" : "send", version, size, sent, 0,
+                 lmp_packet_header_size(version) + size + 1, elapsed);
+}
+
+int main(void) {
+    // NOTE(laith): 0x7F is the terminate byte for older versions, so fill with something else
+    u8 payload[LMP_PACKET_PAYLOAD_MAX_SIZE];
+    memset(payload, 'l', sizeof(payload));
+
+    printf("benchmark,version,payload_size,packets,dropped,ns_per_packet,gb_per_s\n");
+
+    for (size_t v = 0; v < ARR_LENGTH(bench_versions); v++) {
+        for (size_t i = 0; i < ARR_LENGTH(bench_payload_sizes); i++) {
+            lmp_version version = bench_versions[v];
+            size_t size = bench_payload_sizes[i];
+
+            if (lmp_packet_header_size(version) + size + 1 > LMP_PACKET_MAX_SIZE) {
+                size = LMP_PACKET_MAX_SIZE - lmp_packet_header_size(version) - 1;
+            }
+
+            bench_serialize(version, payload, size);
+            bench_serialize_iov(version, payload, size);
+            bench_deserialize(version, payload, size);
+            bench_recv(version, payload, size, 0);
+            bench_recv(version, payload, size, 1);
+            bench_send(version, payload, size, 0);
+            bench_send(version, payload, size, 1);
+        }
+    }
+
+    return 0;
+}
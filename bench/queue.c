@@ -0,0 +1,289 @@
+/*  queue.c - Admiral queue contention benchmark for the LIONS Middleware Protocol
+    Copyright (C) 2026 splatte.dev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+// ===============================================================
+// Prints one CSV row per (queue, producers, consumers) pushing the
+// same number of messages through the admiral queue, then one
+// queue_wakeup row with the time from enqueue until a sleeping
+// consumer has the message:
+//   ./queue [max threads per side] > before.csv
+// ===============================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "../lib/c/lt_arena.h"
+#include "../lib/c/lt_base.h"
+#include "../lib/c/lmp.h"
+#include "../lib/c/liblmp.h"
+
+#define BENCH_MESSAGES 400000
+#define BENCH_PAYLOAD 64
+#define BENCH_CAPACITY 128
+#define BENCH_WAKEUPS 2000
+#define BENCH_WAKEUP_GAP_US 200
+
+// NOTE(laith): the queue admiral used before, a mutex around every operation, with its indices
+// wrapping so it survives more than capacity messages. it copies payloads into the same slots as
+// the lock-free ring so the only difference left is the lock
+typedef struct {
+    pthread_mutex_t mutex;
+    lmp_admiral_queue_slot* slots;
+    u32 capacity;
+    u32 size;
+    u32 head;
+    u32 tail;
+} legacy_queue;
+
+static void legacy_init(legacy_queue* queue, u32 capacity) {
+    pthread_mutex_init(&queue->mutex, NULL);
+    queue->slots = calloc(capacity, sizeof(lmp_admiral_queue_slot));
+    queue->capacity = capacity;
+    queue->size = 0;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+static s8 legacy_enqueue(legacy_queue* queue, const lmp_admiral_message* message) {
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->size == queue->capacity) {
+        pthread_mutex_unlock(&queue->mutex);
+        return -1;
+    }
+
+    lmp_admiral_queue_slot* slot = &queue->slots[queue->tail];
+    slot->message = *message;
+    memcpy(slot->payload, message->packet.payload, message->packet.payload_length);
+    slot->message.packet.payload = slot->payload;
+
+    queue->tail = (queue->tail + 1) % queue->capacity;
+    queue->size++;
+
+    pthread_mutex_unlock(&queue->mutex);
+    return 1;
+}
+
+static s8 legacy_dequeue(legacy_queue* queue, lmp_admiral_message* out, u8* payload) {
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->size == 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        return -1;
+    }
+
+    // NOTE(laith): the slot is free again once the lock drops, so the payload has to leave with it
+    *out = queue->slots[queue->head].message;
+    memcpy(payload, out->packet.payload, out->packet.payload_length);
+    out->packet.payload = payload;
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->size--;
+
+    pthread_mutex_unlock(&queue->mutex);
+    return 1;
+}
+
+typedef struct {
+    u8 legacy;
+    lmp_admiral_queue* ring;
+    legacy_queue* locked;
+    u32 messages;
+    u64* consumed;
+    u64* checksum;
+} bench_args;
+
+static void* bench_producer(void* arg) {
+    bench_args* a = arg;
+    u8 payload[BENCH_PAYLOAD];
+    memset(payload, 'x', sizeof(payload));
+
+    lmp_admiral_message message = {1, 2, {0}, NULL, 0, 0};
+    message.packet.payload = payload;
+    message.packet.payload_length = sizeof(payload);
+
+    for (u32 i = 0; i < a->messages; i++) {
+        payload[0] = (u8)i;
+        while ((a->legacy ? legacy_enqueue(a->locked, &message) : lmp_admiral_queue_enqueue(a->ring, &message)) == -1) {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void* bench_consumer(void* arg) {
+    bench_args* a = arg;
+    u64 sum = 0;
+
+    while (__atomic_load_n(a->consumed, __ATOMIC_RELAXED) < BENCH_MESSAGES) {
+        if (a->legacy) {
+            lmp_admiral_message message;
+            u8 payload[LMP_PACKET_PAYLOAD_MAX_SIZE];
+            if (legacy_dequeue(a->locked, &message, payload) == -1) {
+                sched_yield();
+                continue;
+            }
+
+            sum += message.packet.payload[0];
+        } else {
+            lmp_admiral_message* message = lmp_admiral_queue_dequeue(a->ring);
+            if (message == NULL) {
+                sched_yield();
+                continue;
+            }
+
+            sum += message->packet.payload[0];
+            lmp_admiral_queue_release(a->ring, message);
+        }
+
+        __atomic_add_fetch(a->consumed, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(a->checksum, sum, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static f64 bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64)ts.tv_sec * 1e9 + (f64)ts.tv_nsec;
+}
+
+static f64 bench_queue(u8 legacy, u32 producers, u32 consumers) {
+    lmp_admiral_queue ring;
+    legacy_queue locked;
+    lmp_admiral_queue_init(&ring, BENCH_CAPACITY, NULL);
+    legacy_init(&locked, BENCH_CAPACITY);
+
+    u64 consumed = 0;
+    u64 checksum = 0;
+    bench_args args = {legacy, &ring, &locked, BENCH_MESSAGES / producers, &consumed, &checksum};
+
+    // NOTE(laith): whatever does not divide evenly goes to the first producer
+    bench_args first = args;
+    first.messages += BENCH_MESSAGES % producers;
+
+    pthread_t threads[128];
+    f64 start = bench_now_ns();
+
+    for (u32 i = 0; i < consumers; i++) {
+        pthread_create(&threads[i], NULL, bench_consumer, &args);
+    }
+
+    for (u32 i = 0; i < producers; i++) {
+        pthread_create(&threads[consumers + i], NULL, bench_producer, i == 0 ? &first : &args);
+    }
+
+    for (u32 i = 0; i < producers + consumers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    f64 end = bench_now_ns();
+
+    lmp_admiral_queue_destroy(&ring);
+    free(locked.slots);
+
+    // NOTE(laith): every producer stamps its messages 0, 1, 2... into the first payload byte, so a
+    // message that was lost, doubled or torn shows up in the sum
+    u64 expected = 0;
+    for (u32 i = 0; i < producers; i++) {
+        for (u32 m = 0; m < (i == 0 ? first.messages : args.messages); m++) {
+            expected += (u8)m;
+        }
+    }
+
+    if (consumed != BENCH_MESSAGES || checksum != expected) {
+        fprintf(stderr, "queue lost or corrupted messages with %u producers and %u consumers\n", producers, consumers);
+        exit(1);
+    }
+
+    return (end - start) / BENCH_MESSAGES;
+}
+
+static void* bench_wakeup_consumer(void* arg) {
+    lmp_admiral_queue* ring = arg;
+    f64* total = calloc(1, sizeof(f64));
+
+    for (u32 i = 0; i < BENCH_WAKEUPS; i++) {
+        lmp_admiral_message* message = lmp_admiral_queue_dequeue_wait(ring, -1);
+        f64 now = bench_now_ns();
+
+        f64 sent;
+        memcpy(&sent, message->packet.payload, sizeof(sent));
+        *total += now - sent;
+
+        lmp_admiral_queue_release(ring, message);
+    }
+
+    return total;
+}
+
+// NOTE(laith): messages go in one at a time with a gap between them, so the consumer is asleep in
+// lmp_admiral_queue_dequeue_wait for every one and this is the price of waking it up
+static f64 bench_wakeup(void) {
+    lmp_admiral_queue ring;
+    lmp_admiral_queue_init(&ring, BENCH_CAPACITY, NULL);
+
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, bench_wakeup_consumer, &ring);
+
+    u8 payload[BENCH_PAYLOAD] = {0};
+    lmp_admiral_message message = {1, 2, {0}, NULL, 0, 0};
+    message.packet.payload = payload;
+    message.packet.payload_length = sizeof(payload);
+
+    for (u32 i = 0; i < BENCH_WAKEUPS; i++) {
+        usleep(BENCH_WAKEUP_GAP_US);
+
+        f64 now = bench_now_ns();
+        memcpy(payload, &now, sizeof(now));
+        lmp_admiral_queue_enqueue(&ring, &message);
+    }
+
+    f64* total;
+    pthread_join(consumer, (void**)&total);
+
+    f64 latency = *total / BENCH_WAKEUPS;
+    free(total);
+    lmp_admiral_queue_destroy(&ring);
+
+    return latency;
+}
+
+int main(int argc, char** argv) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 threads = argc > 1 ? (u32)atoi(argv[1]) : (u32)MIN(MAX(cores / 2, 1), 4);
+    threads = MIN(MAX(threads, 1), 64);
+
+    printf("benchmark,producers,consumers,ns_per_message\n");
+
+    for (u32 p = 1; p <= threads; p++) {
+        for (u32 c = 1; c <= threads; c++) {
+            printf("queue_mutex,%u,%u,%.1f\n", p, c, bench_queue(1, p, c));
+            printf("queue_ring,%u,%u,%.1f\n", p, c, bench_queue(0, p, c));
+            fflush(stdout);
+        }
+    }
+
+    printf("queue_wakeup,1,1,%.1f\n", bench_wakeup());
+
+    return 0;
+}
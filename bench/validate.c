@@ -0,0 +1,129 @@
+/*  validate.c - Header validation microbenchmark for the LIONS Middleware Protocol
+    Copyright (C) 2026 splatte.dev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../lib/c/lt_base.h"
+#include "../lib/c/lmp.h"
+
+#define BENCH_HEADERS 4096
+#define BENCH_ROUNDS 20000
+
+// NOTE(laith): this is the version loop and type switch that serialize and deserialize used to
+// duplicate, kept here so the table driven validator has something to be measured against
+static lmp_error legacy_validate(lmp_version version, lmp_type type, lmp_arg arg) {
+    s32 found = 0;
+    for (size_t i = 0; i < ARR_LENGTH(lmp_versions); i++) {
+        if (version == lmp_versions[i]) {
+            found = 1;
+            break;
+        }
+    }
+
+    if (!found) {
+        return LMP_ERR_BAD_VERSION;
+    }
+
+    if (type < LMP_TYPE_INIT || type > LMP_TYPE_INVALID) {
+        return LMP_ERR_BAD_TYPE;
+    }
+
+    switch (type) {
+        case LMP_TYPE_INIT:
+            if (arg < LMP_ARG_INIT_INIT || arg > LMP_ARG_INIT_SHM) return LMP_ERR_BAD_ARG;
+            break;
+        case LMP_TYPE_PING:
+            if (arg != LMP_ARG_PING) return LMP_ERR_BAD_ARG;
+            break;
+        case LMP_TYPE_SEND:
+            if (arg != LMP_ARG_SEND && arg != LMP_ARG_SEND_FRAGMENT) return LMP_ERR_BAD_ARG;
+            break;
+        case LMP_TYPE_TERM:
+            if (arg < LMP_ARG_TERM_CLEAN || arg > LMP_ARG_TERM_BUSY) return LMP_ERR_BAD_ARG;
+            break;
+        case LMP_TYPE_INVALID:
+            if (arg < LMP_ARG_INVALID_VERSION || arg > LMP_ARG_INVALID_PAYLOAD) return LMP_ERR_BAD_ARG;
+            break;
+    }
+
+    return LMP_ERR_NONE;
+}
+
+typedef lmp_error (*validator)(lmp_version version, lmp_type type, lmp_arg arg);
+
+// NOTE(laith): calling through a volatile pointer keeps the compiler from treating the legacy
+// validator as a pure function local to this file, so both sides pay the same call cost
+static f64 bench_validator(validator volatile fn, u8 (*headers)[3]) {
+    volatile u32 sink = 0;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    f64 start = (f64)ts.tv_sec * 1e9 + (f64)ts.tv_nsec;
+
+    for (u32 r = 0; r < BENCH_ROUNDS; r++) {
+        for (u32 i = 0; i < BENCH_HEADERS; i++) {
+            sink += fn(headers[i][0], headers[i][1], headers[i][2]);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    f64 end = (f64)ts.tv_sec * 1e9 + (f64)ts.tv_nsec;
+
+    return (end - start) / ((f64)BENCH_HEADERS * BENCH_ROUNDS);
+}
+
+int main(void) {
+    static u8 headers[BENCH_HEADERS][3];
+
+    // NOTE(laith): mostly well formed traffic with some garbage mixed in, like a real socket
+    srand(5321);
+    for (u32 i = 0; i < BENCH_HEADERS; i++) {
+        if (rand() % 8 == 0) {
+            headers[i][0] = rand() % 4;
+            headers[i][1] = rand() % 8;
+            headers[i][2] = rand() % 8;
+            continue;
+        }
+
+        headers[i][0] = lmp_versions[rand() % ARR_LENGTH(lmp_versions)];
+        headers[i][1] = LMP_TYPE_INIT + rand() % 5;
+        headers[i][2] = headers[i][1] == LMP_TYPE_INVALID ? 1 + rand() % 6 : rand() % 3;
+    }
+
+    u32 mismatches = 0;
+    for (u32 i = 0; i < BENCH_HEADERS; i++) {
+        if (legacy_validate(headers[i][0], headers[i][1], headers[i][2])
+            != lmp_packet_validate(headers[i][0], headers[i][1], headers[i][2])) {
+            mismatches++;
+        }
+    }
+
+    if (mismatches) {
+        fprintf(stderr, "validators disagree on %u headers\n", mismatches);
+        return 1;
+    }
+
+    f64 legacy = bench_validator(legacy_validate, headers);
+    f64 table = bench_validator(lmp_packet_validate, headers);
+
+    printf("benchmark,ns_per_packet\n");
+    printf("validate_legacy,%.3f\n", legacy);
+    printf("validate_table,%.3f\n", table);
+
+    return 0;
+}
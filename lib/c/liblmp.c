@@ -15,23 +15,132 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>. */
 
 
+// NOTE(laith): for struct ucred and memfd_create
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <pwd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
 
 #include "liblmp.h"
 #include "lt_arena.h"
 #include "lt_base.h"
 #include "lmp.h"
 
+#if OS_LINUX
+#include <sys/eventfd.h>
+#endif
+
 // ===============================================================
 // Net
 // ===============================================================
 
+// NOTE(laith): sendmsg instead of writev so a peer that hung up is an error here and not a SIGPIPE
+// that takes the whole service down. mirage has neither MSG_NOSIGNAL nor MSG_MORE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+u64 lmp_net_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+}
+
+u64 lmp_net_deadline(u32 timeout_ms) {
+    return lmp_net_now_ms() + timeout_ms;
+}
+
+// NOTE(laith): waits for fd to be ready or the deadline to pass. an error or hangup counts as ready,
+// the read or write that follows is what reports it
+static lmp_error lmp_net_wait(u32 fd, short events, u64 deadline) {
+    for (;;) {
+        u64 now = lmp_net_now_ms();
+        if (now >= deadline) {
+            return LMP_ERR_TIMEOUT;
+        }
+
+        struct pollfd p = {(int)fd, events, 0};
+        int r = poll(&p, 1, (int)MIN(deadline - now, (u64)INT32_MAX));
+        if (r > 0) {
+            return LMP_ERR_NONE;
+        }
+
+        if (r == 0) {
+            return LMP_ERR_TIMEOUT;
+        }
+
+        if (errno != EINTR) {
+            return LMP_ERR_BAD_INPUT;
+        }
+    }
+}
+
+// NOTE(laith): every call is MSG_DONTWAIT and only waits in poll when the socket buffer is full, so
+// the deadline costs nothing while the peer keeps up and a peer that stops reading can only hold
+// the caller until it passes. a peer that hung up is LMP_ERR_CLOSED
+static lmp_error lmp_net_writev_all(u32 fd, struct iovec* iov, int count, int flags, u64 deadline) {
+    while (count > 0) {
+        struct msghdr message = {0};
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+
+        ssize_t written = sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT | flags);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                lmp_error error = lmp_net_wait(fd, POLLOUT, deadline);
+                if (error != LMP_ERR_NONE) {
+                    return error;
+                }
+                continue;
+            }
+
+            return errno == EPIPE || errno == ECONNRESET ? LMP_ERR_CLOSED : LMP_ERR_BAD_INPUT;
+        }
+
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (u8*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return LMP_ERR_NONE;
+}
+
 lmp_error lmp_net_send_packet(u32 fd, const lmp_packet* packet, lmp_result* result) {
     u8 buffer[LMP_PACKET_MAX_SIZE];
     lmp_packet_serialize(buffer, sizeof(buffer), packet, result);
@@ -39,290 +148,3798 @@ lmp_error lmp_net_send_packet(u32 fd, const lmp_packet* packet, lmp_result* resu
         return result->error;
     }
 
-    ssize_t sent = send(fd, buffer, result->size, 0);
-    if (sent < 0) {
-        return LMP_ERR_BAD_INPUT;
+    struct iovec iov = {buffer, result->size};
+    return lmp_net_writev_all(fd, &iov, 1, 0, lmp_net_deadline(LMP_NET_SEND_TIMEOUT_MS));
+}
+
+lmp_error lmp_net_send_packet_iov(u32 fd, const lmp_packet* packet, lmp_result* result) {
+    u8 header[LMP_PACKET_HEADER_MAX_SIZE];
+    struct iovec iov[LMP_PACKET_IOV_COUNT];
+
+    lmp_packet_serialize_iov(header, iov, packet, result);
+    if (result->error != LMP_ERR_NONE) {
+        return result->error;
+    }
+
+    return lmp_net_writev_all(fd, iov, LMP_PACKET_IOV_COUNT, 0, lmp_net_deadline(LMP_NET_SEND_TIMEOUT_MS));
+}
+
+// NOTE(laith): packets go out LMP_NET_SEND_BATCH at a time, one sendmsg each. every call but the
+// last is flagged MSG_MORE so the kernel fills whole segments across them, and the last one pushes
+// out whatever is left straight away. a packet that does not serialize stops the batch after the
+// ones in front of it have gone out. result->size is how many packets were written
+lmp_error lmp_net_send_batch(u32 fd, const lmp_packet* packets, size_t count, lmp_result* result) {
+    u8 headers[LMP_NET_SEND_BATCH][LMP_PACKET_HEADER_MAX_SIZE];
+    struct iovec iov[LMP_NET_SEND_BATCH * LMP_PACKET_IOV_COUNT];
+    u64 deadline = lmp_net_deadline(LMP_NET_SEND_TIMEOUT_MS);
+
+    size_t sent = 0;
+    while (sent < count) {
+        size_t built = 0;
+        lmp_error error = LMP_ERR_NONE;
+
+        while (built < LMP_NET_SEND_BATCH && sent + built < count) {
+            lmp_packet_serialize_iov(headers[built], &iov[built * LMP_PACKET_IOV_COUNT], &packets[sent + built], result);
+            if (result->error != LMP_ERR_NONE) {
+                error = result->error;
+                break;
+            }
+            built++;
+        }
+
+        int more = error == LMP_ERR_NONE && sent + built < count ? MSG_MORE : 0;
+        if (built > 0) {
+            lmp_error sendError = lmp_net_writev_all(fd, iov, built * LMP_PACKET_IOV_COUNT, more, deadline);
+            if (sendError != LMP_ERR_NONE) {
+                error = sendError;
+                built = 0;
+            }
+        }
+
+        sent += built;
+
+        if (error != LMP_ERR_NONE) {
+            result->error = error;
+            result->size = sent;
+            return error;
+        }
     }
 
+    result->error = LMP_ERR_NONE;
+    result->size = sent;
     return result->error;
 }
 
-lmp_error lmp_net_recv_packet(u32 fd, u8* buffer, size_t size, lmp_packet* packet, lmp_result* result) {
-    u8 terminated = 0;
-    u8 invalid = 0;
-    u64 packet_size = 0;
+// NOTE(laith): nodelay is for sockets where every packet is waited on, like control traffic and
+// forwarding. cork holds small writes back until a full segment builds up or the cork comes off,
+// which is for bursts; uncorking flushes. mirage calls it TCP_NOPUSH
+lmp_error lmp_net_set_nodelay(u32 fd, u8 enabled) {
+    int opt = enabled ? 1 : 0;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1 ? LMP_ERR_BAD_INPUT : LMP_ERR_NONE;
+}
 
-    for (;;) {
-        u8 scratch[LMP_PACKET_MAX_SIZE];
+lmp_error lmp_net_set_cork(u32 fd, u8 enabled) {
+    int opt = enabled ? 1 : 0;
+#if defined(TCP_CORK)
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt)) == -1 ? LMP_ERR_BAD_INPUT : LMP_ERR_NONE;
+#else
+    return setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, &opt, sizeof(opt)) == -1 ? LMP_ERR_BAD_INPUT : LMP_ERR_NONE;
+#endif
+}
 
-        int bytes = recv(fd, scratch, sizeof(scratch), 0);
-        if (bytes <= 0) {
-            break;
+// NOTE(laith): a frame gets LMP_NET_FRAME_TIMEOUT_MS in total once its first byte shows up and no
+// read inside it may wait longer than LMP_NET_RECV_TIMEOUT_MS. before the first byte only the
+// caller's deadline applies, so waiting on a quiet connection is still fine
+typedef struct {
+    u64 deadline;
+    u8 started;
+} lmp_net_clock;
+
+static void lmp_net_clock_start(lmp_net_clock* clock) {
+    if (!clock->started) {
+        clock->started = 1;
+        clock->deadline = MIN(clock->deadline, lmp_net_deadline(LMP_NET_FRAME_TIMEOUT_MS));
+    }
+}
+
+static u64 lmp_net_clock_next(const lmp_net_clock* clock) {
+    return clock->started ? MIN(clock->deadline, lmp_net_deadline(LMP_NET_RECV_TIMEOUT_MS)) : clock->deadline;
+}
+
+static lmp_error lmp_net_recv_some(u32 fd, u8* buffer, size_t size, lmp_net_clock* clock, size_t* received) {
+    for (;;) {
+        ssize_t bytes = recv(fd, buffer, size, MSG_DONTWAIT);
+        if (bytes > 0) {
+            lmp_net_clock_start(clock);
+            *received = bytes;
+            return LMP_ERR_NONE;
         }
 
-        for (int i = 0; i < bytes; i++) {
-            buffer[packet_size] = scratch[i];
-            packet_size++;
+        if (bytes == 0) {
+            return LMP_ERR_CLOSED;
+        }
 
-            if (packet_size >= size) {
-                invalid = 1;
-                break;
-            }
+        if (errno == EINTR) {
+            continue;
+        }
 
-            if (scratch[i] == LMP_PACKET_TERMINATE) {
-                terminated = 1;
-                break;
-            }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return LMP_ERR_BAD_INPUT;
         }
 
-        if (terminated || invalid) break;
+        lmp_error error = lmp_net_wait(fd, POLLIN, lmp_net_clock_next(clock));
+        if (error != LMP_ERR_NONE) {
+            return error;
+        }
     }
+}
 
-    if (terminated) {
-        lmp_packet_deserialize(buffer, packet_size, packet, result);
-        return result->error;
-    }
+static lmp_error lmp_net_recv_exact(u32 fd, u8* buffer, size_t size, lmp_net_clock* clock) {
+    size_t received = 0;
 
-    if (invalid) {
-        return LMP_ERR_BAD_SIZE;
+    while (received < size) {
+        size_t bytes;
+        lmp_error error = lmp_net_recv_some(fd, buffer + received, size - received, clock, &bytes);
+        if (error != LMP_ERR_NONE) {
+            return error;
+        }
+
+        received += bytes;
     }
 
-    return LMP_ERR_BAD_INPUT;
+    return LMP_ERR_NONE;
 }
 
-char* lmp_net_get_client(u32 fd, mem_arena* arena) {
-    struct sockaddr clientAddr = {0};
-    socklen_t clientAddrLen = sizeof(clientAddr);
-    int g = getpeername(fd, (struct sockaddr*)&clientAddr, &clientAddrLen);
-    if (g == -1) {
-        return NULL;
+lmp_error lmp_net_recv_packet(u32 fd, u8* buffer, size_t size, lmp_packet* packet, lmp_result* result) {
+    return lmp_net_recv_packet_deadline(fd, buffer, size, LMP_NET_NO_DEADLINE, packet, result);
+}
+
+// NOTE(laith): every version shares the first four header bytes, and no packet is shorter than
+// that, so reading them tells us how the rest of the packet is framed without reading past it
+lmp_error lmp_net_recv_packet_deadline(u32 fd, u8* buffer, size_t size, u64 deadline, lmp_packet* packet, lmp_result* result) {
+    lmp_net_clock clock = {deadline, 0};
+    u64 packet_size = LMP_PACKET_HEADER_SIZE;
+
+    if (size < LMP_PACKET_HEADER_MAX_SIZE) {
+        return LMP_ERR_BAD_SIZE;
+    }
+
+    lmp_error error = lmp_net_recv_exact(fd, buffer, LMP_PACKET_HEADER_SIZE, &clock);
+    if (error != LMP_ERR_NONE) {
+        return error;
     }
 
-    char host[255] = {0};
-    char port[255] = {0};
+    if (lmp_packet_header_size(buffer[0]) == LMP_PACKET_V3_HEADER_SIZE) {
+        error = lmp_net_recv_exact(fd, buffer + LMP_PACKET_HEADER_SIZE,
+                                   LMP_PACKET_V3_HEADER_SIZE - LMP_PACKET_HEADER_SIZE, &clock);
+        if (error != LMP_ERR_NONE) {
+            return error;
+        }
 
-    int n = getnameinfo(&clientAddr, clientAddrLen, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
-    if (n != 0) {
-        return NULL;
+        lmp_packet_frame(buffer, LMP_PACKET_V3_HEADER_SIZE, result);
+        if (result->error != LMP_ERR_INCOMPLETE) {
+            return result->error;
+        }
+
+        size_t frame_size = result->size;
+        if (frame_size > size) {
+            return LMP_ERR_BAD_SIZE;
+        }
+
+        error = lmp_net_recv_exact(fd, buffer + LMP_PACKET_V3_HEADER_SIZE,
+                                   frame_size - LMP_PACKET_V3_HEADER_SIZE, &clock);
+        if (error != LMP_ERR_NONE) {
+            return error;
+        }
+
+        lmp_packet_deserialize(buffer, frame_size, packet, result);
+        return result->error;
+    }
+
+    size_t end = lmp_packet_find_terminate(buffer, LMP_PACKET_HEADER_SIZE);
+    if (end < LMP_PACKET_HEADER_SIZE) {
+        lmp_packet_deserialize(buffer, end + 1, packet, result);
+        return result->error;
     }
 
-    char name[255] = {0};
-    snprintf(name, sizeof(name), "%s:%s", host, port);
+    for (;;) {
+        if (packet_size >= size) {
+            return LMP_ERR_BAD_SIZE;
+        }
+
+        size_t bytes;
+        error = lmp_net_recv_some(fd, buffer + packet_size, size - packet_size, &clock, &bytes);
+        if (error != LMP_ERR_NONE) {
+            return error;
+        }
 
-    char* allocatedName = arena_push(arena, sizeof(name));
-    memcpy(allocatedName, name, sizeof(name));
+        end = lmp_packet_find_terminate(buffer + packet_size, bytes);
+        if (end < bytes) {
+            lmp_packet_deserialize(buffer, packet_size + end + 1, packet, result);
+            return result->error;
+        }
 
-    return allocatedName;
+        packet_size += bytes;
+    }
 }
 
+void lmp_net_reader_init(lmp_net_reader* reader, u32 fd, mem_arena* arena) {
+    reader->fd = fd;
+    reader->buffer = arena_push(arena, LMP_NET_READER_CAPACITY);
+    reader->capacity = reader->buffer ? LMP_NET_READER_CAPACITY : 0;
+    reader->start = 0;
+    reader->end = 0;
+}
 
-// lmp_error lmp_net_send_packet_to_admiral(char* endpoint, const lmp_packet* packet, lmp_result* result) {
-//     mem_arena* arena = arena_create(KiB(8));
-//
-//     return NULL;
-// }
+// NOTE(laith): reuses the buffer for a new connection, anything left from the old one is dropped
+void lmp_net_reader_reset(lmp_net_reader* reader, u32 fd) {
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+}
 
-// ===============================================================
-// Log
-// ===============================================================
+// NOTE(laith): one recv into the free space at the back of the buffer. the unread bytes only get
+// moved when there is not room for a whole packet behind them, and that is never more than one
+// partial packet, so most fills copy nothing
+lmp_error lmp_net_reader_fill(lmp_net_reader* reader) {
+    if (reader->capacity - reader->end < LMP_PACKET_MAX_SIZE) {
+        size_t unread = reader->end - reader->start;
+        memmove(reader->buffer, reader->buffer + reader->start, unread);
+        reader->start = 0;
+        reader->end = unread;
+    }
 
-const char* lmp_log_print_type_colors[] = {
-    LMP_LOG_COLOR_INFO,
-    LMP_LOG_COLOR_WARN,
-    LMP_LOG_COLOR_ERROR
-};
+    for (;;) {
+        ssize_t bytes = recv(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end, 0);
+        if (bytes > 0) {
+            reader->end += bytes;
+            return LMP_ERR_NONE;
+        }
 
-void lmp_log_print(const char* service, const char* message, lmp_log_print_type type) {
-	time_t timestamp = time(NULL);
-	struct tm* time_info = localtime(&timestamp);
+        if (bytes == 0) {
+            return LMP_ERR_CLOSED;
+        }
 
-    switch (type) {
-        case LMP_PRINT_TYPE_INFO:
-            fprintf(stderr, "%s[%s] %02d:%02d:%02d [INFO]: %s%s\n", lmp_log_print_type_colors[type], service, time_info->tm_hour, time_info->tm_min, time_info->tm_sec, message, LMP_LOG_COLOR_RESET);
-            return;
-        case LMP_PRINT_TYPE_WARN:
-            fprintf(stderr, "%s[%s] %02d:%02d:%02d [WARN]: %s%s\n", lmp_log_print_type_colors[type], service, time_info->tm_hour, time_info->tm_min, time_info->tm_sec, message, LMP_LOG_COLOR_RESET);
-            return;
-        case LMP_PRINT_TYPE_ERROR:
-            fprintf(stderr, "%s[%s] %02d:%02d:%02d [ERROR]: %s%s\n", lmp_log_print_type_colors[type], service, time_info->tm_hour, time_info->tm_min, time_info->tm_sec, message, LMP_LOG_COLOR_RESET);
-            return;
+        if (errno == EINTR) {
+            continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return LMP_ERR_INCOMPLETE;
+        }
+
+        return LMP_ERR_BAD_INPUT;
     }
 }
 
-// ===============================================================
-// Admiral
-// ===============================================================
-
-char* lmp_admiral_endpoints[] = {
-    "admiral",
-    "hotel",
-    "scheduler",
-};
+// NOTE(laith): for bytes that were read somewhere else, like a buffer io_uring filled. anything
+// bigger than the free space after compacting means the peer is not speaking lmp
+lmp_error lmp_net_reader_push(lmp_net_reader* reader, const u8* data, size_t size) {
+    if (reader->capacity - reader->end < size) {
+        size_t unread = reader->end - reader->start;
+        memmove(reader->buffer, reader->buffer + reader->start, unread);
+        reader->start = 0;
+        reader->end = unread;
+    }
 
-void lmp_admiral_queue_init(lmp_admiral_queue* queue, u8 capacity) {
-    mem_arena* arena = arena_create(MiB(10));
-    queue->arena = arena;
-    queue->size = 0;
-    queue->capacity = capacity;
-    queue->head = 0;
-    queue->tail = 0;
+    if (reader->capacity - reader->end < size) {
+        return LMP_ERR_BAD_SIZE;
+    }
 
-    queue->messages = arena_push(queue->arena, sizeof(lmp_admiral_message*) * capacity);
+    memcpy(reader->buffer + reader->end, data, size);
+    reader->end += size;
 
-    pthread_mutex_init(&queue->mutex, NULL);
+    return LMP_ERR_NONE;
 }
 
-s8 lmp_admiral_queue_enqueue(lmp_admiral_queue* queue, const lmp_admiral_message* message) {
-    pthread_mutex_lock(&queue->mutex);
+// NOTE(laith): hands back the next packet already sitting in the buffer without reading from the
+// socket. a packet that fails to deserialize is still consumed, a stream that can not be framed
+// at all is not, the connection is garbage at that point
+lmp_error lmp_net_reader_next(lmp_net_reader* reader, lmp_packet* packet, lmp_result* result) {
+    const u8* frame = reader->buffer + reader->start;
+    size_t frame_size = lmp_packet_frame(frame, reader->end - reader->start, result);
+    if (result->error != LMP_ERR_NONE) {
+        return result->error;
+    }
 
-    if (queue->size >= queue->capacity) {
-        pthread_mutex_unlock(&queue->mutex);
-        return -1;
+    reader->start += frame_size;
+    if (reader->start == reader->end) {
+        reader->start = 0;
+        reader->end = 0;
     }
 
-    lmp_admiral_message* allocated = arena_push(queue->arena, sizeof(lmp_admiral_message));
+    lmp_packet_deserialize(frame, frame_size, packet, result);
+    return result->error;
+}
+
+lmp_error lmp_net_reader_recv(lmp_net_reader* reader, lmp_packet* packet, lmp_result* result) {
+    return lmp_net_reader_recv_deadline(reader, LMP_NET_NO_DEADLINE, packet, result);
+}
 
-    *allocated = *message;
+// NOTE(laith): same frame clock as lmp_net_recv_packet_deadline, started by the first byte of a
+// frame that is already sitting in the buffer as much as by one that is read here
+lmp_error lmp_net_reader_recv_deadline(lmp_net_reader* reader, u64 deadline, lmp_packet* packet, lmp_result* result) {
+    lmp_net_clock clock = {deadline, 0};
 
-    queue->messages[queue->tail++] = allocated;
-    queue->size++;
+    for (;;) {
+        lmp_error error = lmp_net_reader_next(reader, packet, result);
+        if (error != LMP_ERR_INCOMPLETE) {
+            return error;
+        }
 
-    pthread_mutex_unlock(&queue->mutex);
+        if (reader->end > reader->start) {
+            lmp_net_clock_start(&clock);
+        }
 
-    return 1;
+        error = lmp_net_wait(reader->fd, POLLIN, lmp_net_clock_next(&clock));
+        if (error != LMP_ERR_NONE) {
+            return error;
+        }
+
+        error = lmp_net_reader_fill(reader);
+        if (error != LMP_ERR_NONE && error != LMP_ERR_INCOMPLETE) {
+            return error;
+        }
+    }
 }
 
-lmp_admiral_message* lmp_admiral_queue_dequeue(lmp_admiral_queue* queue) {
-    pthread_mutex_lock(&queue->mutex);
+// NOTE(laith): a non-blocking connect waited on with poll so an unreachable host costs timeout_ms
+// instead of the kernel's minutes of SYN retries. local_port binds the source port first, which is
+// how admiral tells clients apart, 0 leaves it to the kernel. returns the connected socket, back
+// in blocking mode, or -1 with result->error set
+s32 lmp_net_connect(const char* host, u16 port, u16 local_port, u32 timeout_ms, lmp_result* result) {
+    lmp_result_init(result);
+    result->error = LMP_ERR_BAD_INPUT;
 
-    if (queue->size == 0) {
-        pthread_mutex_unlock(&queue->mutex);
-        return NULL;
+    int socketFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketFd == -1) {
+        return -1;
+    }
+
+    if (local_port != 0) {
+        int opt = 1;
+        struct sockaddr_in localAddr = {0};
+        localAddr.sin_family = AF_INET;
+        localAddr.sin_port = htons(local_port);
+        localAddr.sin_addr.s_addr = INADDR_ANY;
+
+        if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1
+            || bind(socketFd, (struct sockaddr*)&localAddr, sizeof(localAddr)) == -1) {
+            close(socketFd);
+            return -1;
+        }
+    }
+
+    int flags = fcntl(socketFd, F_GETFL, 0);
+    if (flags == -1 || fcntl(socketFd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        close(socketFd);
+        return -1;
     }
 
-    lmp_admiral_message* msg = queue->messages[queue->head++];
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    serverAddr.sin_addr.s_addr = inet_addr(host);
+
+    if (connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+        if (errno != EINPROGRESS) {
+            close(socketFd);
+            return -1;
+        }
 
-    queue->size--;
+        lmp_error error = lmp_net_wait(socketFd, POLLOUT, lmp_net_deadline(timeout_ms));
+        int socketError = 0;
+        socklen_t length = sizeof(socketError);
 
-    if (queue->size == 0) {
-        arena_clear(queue->arena);
-        queue->head = 0;
-        queue->tail = 0;
+        if (error != LMP_ERR_NONE
+            || getsockopt(socketFd, SOL_SOCKET, SO_ERROR, &socketError, &length) == -1 || socketError != 0) {
+            close(socketFd);
+            result->error = error == LMP_ERR_NONE ? LMP_ERR_BAD_INPUT : error;
+            return -1;
+        }
     }
 
-    pthread_mutex_unlock(&queue->mutex);
+    if (fcntl(socketFd, F_SETFL, flags) == -1) {
+        close(socketFd);
+        return -1;
+    }
 
-    return msg;
+    result->error = LMP_ERR_NONE;
+    return socketFd;
 }
 
-// NOTE(laith): this function changes how ownership of the packet is handled. This paacket lives
-// in the network loop arena and now it is getting copied over to the queue arena. with that, after
-// this function ends, we can safely pop the packet memory of the network arena and start again
-//
-// Do NOT share memory across threads!
-s8 lmp_admiral_add_packet_to_queue(lmp_admiral_queue* queue, lmp_packet* packet, char* endpoint) {
-    char logBuffer[255] = {0};
+s32 lmp_net_open_datagram(const char* host, u16 port, u16 local_port, lmp_result* result) {
+    lmp_result_init(result);
+    result->error = LMP_ERR_BAD_INPUT;
 
-    // NOTE(laith): this should be [dest][sender][EMPTY PAYLOAD BYTE] at the minimum
-    if (packet->payload_length < 3) {
+    int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd == -1) {
         return -1;
     }
 
-    // NOTE(laith): this converts and ascii string to its byte form
-    u8 destination = packet->payload[0] - '0';
-    u8 sender = packet->payload[1] - '0';
-
-    if (destination > SCHEDULER || sender > SCHEDULER) {
+    struct sockaddr_in localAddr = {0};
+    localAddr.sin_family = AF_INET;
+    localAddr.sin_port = htons(local_port);
+    localAddr.sin_addr.s_addr = INADDR_ANY;
+
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    serverAddr.sin_addr.s_addr = inet_addr(host);
+
+    int opt = 1;
+    if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1
+        || bind(socketFd, (struct sockaddr*)&localAddr, sizeof(localAddr)) == -1
+        || connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+        close(socketFd);
         return -1;
     }
 
-    switch (sender) {
-        case ADMIRAL:
-            if (strcmp(endpoint, "admiral") != 0) {
-                snprintf(logBuffer, sizeof(logBuffer), "[%s] is claiming to be a [admiral]", endpoint);
-                lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_ERROR);
-                return -1;
+    result->error = LMP_ERR_NONE;
+    return socketFd;
+}
+
+// NOTE(laith): sends stop at the first packet that does not serialize or datagram the kernel
+// refuses, a connected socket reports a closed port on the send after the one that hit it.
+// result->size is how many packets went out, which says nothing about how many arrived. with
+// requests every packet goes back to where its request came from, otherwise everything goes to to
+static lmp_error lmp_net_sendmmsg(u32 fd, const lmp_packet* packets, size_t count, const struct sockaddr* to,
+                                  socklen_t to_length, const lmp_net_datagram* const* requests, lmp_result* result) {
+    u8 headers[LMP_NET_DATAGRAM_BATCH][LMP_PACKET_HEADER_MAX_SIZE];
+    struct iovec iov[LMP_NET_DATAGRAM_BATCH][LMP_PACKET_IOV_COUNT];
+#if OS_LINUX
+    struct mmsghdr messages[LMP_NET_DATAGRAM_BATCH];
+#endif
+
+    lmp_result_init(result);
+
+    size_t sent = 0;
+    lmp_error error = LMP_ERR_NONE;
+
+    while (sent < count && error == LMP_ERR_NONE) {
+        u32 built = 0;
+        while (built < LMP_NET_DATAGRAM_BATCH && sent + built < count) {
+            lmp_packet_serialize_iov(headers[built], iov[built], &packets[sent + built], result);
+            if (result->error != LMP_ERR_NONE) {
+                error = result->error;
+                break;
             }
+            built++;
+        }
 
-            break;
-        case HOTEL:
-            if (strcmp(endpoint, "hotel") != 0) {
-                snprintf(logBuffer, sizeof(logBuffer), "[%s] is claiming to be a [hotel]", endpoint);
-                lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_ERROR);
-                return -1;
+        u32 done = 0;
+        while (done < built) {
+#if OS_LINUX
+            for (u32 i = done; i < built; i++) {
+                memset(&messages[i], 0, sizeof(messages[i]));
+                messages[i].msg_hdr.msg_name = requests ? (void*)&requests[sent + i]->address : (void*)to;
+                messages[i].msg_hdr.msg_namelen = requests ? requests[sent + i]->addressLength : to ? to_length : 0;
+                messages[i].msg_hdr.msg_iov = iov[i];
+                messages[i].msg_hdr.msg_iovlen = LMP_PACKET_IOV_COUNT;
             }
 
-            break;
-        case SCHEDULER:
-            if (strcmp(endpoint, "scheduler") != 0) {
-                snprintf(logBuffer, sizeof(logBuffer), "[%s] is claiming to be a [scheduler]", endpoint);
-                lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_ERROR);
-                return -1;
+            int n = sendmmsg(fd, &messages[done], built - done, MSG_NOSIGNAL);
+#else
+            struct msghdr message = {0};
+            message.msg_name = requests ? (void*)&requests[sent + done]->address : (void*)to;
+            message.msg_namelen = requests ? requests[sent + done]->addressLength : to ? to_length : 0;
+            message.msg_iov = iov[done];
+            message.msg_iovlen = LMP_PACKET_IOV_COUNT;
+
+            int n = sendmsg(fd, &message, MSG_NOSIGNAL) < 0 ? -1 : 1;
+#endif
+            if (n < 0 && errno == EINTR) {
+                continue;
             }
 
-            break;
-    }
+            // NOTE(laith): sending nothing at all leaves errno as it was, so that says nothing
+            if (n == 0) {
+                error = LMP_ERR_BAD_INPUT;
+                break;
+            }
 
-    lmp_admiral_message message = {destination, sender, *packet};
-    s8 e = lmp_admiral_queue_enqueue(queue, &message);
-    if (e == -1) {
-        snprintf(logBuffer, sizeof(logBuffer), "Could not enqueue message from [%s]", endpoint);
-        lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_ERROR);
-        return -1;
+            if (n < 0) {
+                error = errno == ECONNREFUSED ? LMP_ERR_CLOSED : LMP_ERR_BAD_INPUT;
+                break;
+            }
+
+            done += n;
+        }
+
+        sent += done;
     }
 
-    snprintf(logBuffer, sizeof(logBuffer), "Recieved and added message from [%s] to queue", endpoint);
-    lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_INFO);
+    result->error = error;
+    result->size = sent;
+    return error;
+}
 
-    return 1;
+lmp_error lmp_net_send_datagrams(u32 fd, const lmp_packet* packets, size_t count,
+                                 const struct sockaddr* to, socklen_t to_length, lmp_result* result) {
+    return lmp_net_sendmmsg(fd, packets, count, to, to_length, NULL, result);
 }
 
-// NOTE(laith): probably want some further checks here but given the checks within the enqueue call
-// and the protocol itself, it should be fine?
-void lmp_admiral_sanitize_message(lmp_admiral_message* message) {
-    u64 sanitizedPayloadSize = message->packet.payload_length - 2;
-    u8 sanitizedPayload[sanitizedPayloadSize];
+lmp_error lmp_net_reply_datagrams(u32 fd, const lmp_packet* replies, const lmp_net_datagram* const* requests,
+                                  size_t count, lmp_result* result) {
+    return lmp_net_sendmmsg(fd, replies, count, NULL, 0, requests, result);
+}
+
+// NOTE(laith): takes whatever is waiting without blocking, up to count. returns how many datagrams
+// were read, 0 when there were none and -1 when the socket failed
+s32 lmp_net_recv_datagrams(u32 fd, lmp_net_datagram* datagrams, u32 count) {
+    count = MIN(count, LMP_NET_DATAGRAM_BATCH);
 
-    u64 sanitizedPayloadInput = 0;
-    for (u64 i = 2; i < message->packet.payload_length; i++) {
-        sanitizedPayload[sanitizedPayloadInput++] = message->packet.payload[i];
+#if OS_LINUX
+    struct mmsghdr messages[LMP_NET_DATAGRAM_BATCH];
+    struct iovec iov[LMP_NET_DATAGRAM_BATCH];
+
+    for (u32 i = 0; i < count; i++) {
+        iov[i].iov_base = datagrams[i].data;
+        iov[i].iov_len = sizeof(datagrams[i].data);
+
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_name = &datagrams[i].address;
+        messages[i].msg_hdr.msg_namelen = sizeof(datagrams[i].address);
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
     }
 
-    memcpy((void*)message->packet.payload, sanitizedPayload, sanitizedPayloadSize);
-    message->packet.payload_length = sanitizedPayloadSize;
-}
+    int n;
+    do {
+        n = recvmmsg(fd, messages, count, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
 
-void lmp_admiral_invalidate_packet(lmp_packet* packet) {
-    packet->type = LMP_TYPE_INVALID;
-    packet->arg = LMP_ARG_INVALID_PAYLOAD;
-    packet->flags = LMP_FLAGS_NONE;
-    packet->payload = LMP_PAYLOAD_EMPTY;
-    packet->payload_length = 1;
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        datagrams[i].length = messages[i].msg_hdr.msg_flags & MSG_TRUNC ? 0 : messages[i].msg_len;
+        datagrams[i].addressLength = messages[i].msg_hdr.msg_namelen;
+    }
+
+    return n;
+#else
+    u32 n = 0;
+    while (n < count) {
+        datagrams[n].addressLength = sizeof(datagrams[n].address);
+
+        ssize_t bytes = recvfrom(fd, datagrams[n].data, sizeof(datagrams[n].data), MSG_DONTWAIT,
+                                 (struct sockaddr*)&datagrams[n].address, &datagrams[n].addressLength);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return n > 0 ? (s32)n : -1;
+        }
+
+        // NOTE(laith): without MSG_TRUNC a cut datagram just looks full, and fails to parse
+        datagrams[n].length = bytes;
+        n++;
+    }
+
+    return n;
+#endif
 }
 
-char* lmp_admiral_map_client_to_endpoint(char* client) {
-    if (strcmp(client, ADMIRAL_ENDPOINT_ADMIRAL) == 0) {
-        return "admiral";
+// NOTE(laith): unix sockets connect or fail straight away, there is no handshake to wait out
+s32 lmp_net_connect_unix(const char* path, lmp_result* result) {
+    lmp_result_init(result);
+    result->error = LMP_ERR_BAD_INPUT;
+
+    struct sockaddr_un serverAddr = {0};
+    serverAddr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(serverAddr.sun_path)) {
+        return -1;
     }
+    strcpy(serverAddr.sun_path, path);
 
-    if (strcmp(client, ADMIRAL_ENDPOINT_HOTEL) == 0) {
-        return "hotel";
+    int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketFd == -1) {
+        return -1;
     }
 
-    if (strcmp(client, ADMIRAL_ENDPOINT_SCHEDULER) == 0) {
-        return "scheduler";
+    if (connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+        close(socketFd);
+        return -1;
     }
 
-    return NULL;
+    result->error = LMP_ERR_NONE;
+    return socketFd;
 }
 
-static char* endpoint[] = {
-    "admiral",
-    "hotel",
-    "scheduler"
-};
+// NOTE(laith): the kernel vouches for who is on the other end of a unix socket, which is what
+// makes it usable as an identity where a source port is only a convention
+s8 lmp_net_get_peer_uid(u32 fd, u32* uid) {
+#if OS_LINUX
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == -1) {
+        return -1;
+    }
+
+    *uid = credentials.uid;
+#else
+    uid_t peerUid;
+    gid_t peerGid;
+    if (getpeereid(fd, &peerUid, &peerGid) == -1) {
+        return -1;
+    }
 
-char* lmp_admiral_map_id_to_endpoint(u8 id) {
-    return endpoint[id];
+    *uid = peerUid;
+#endif
+
+    return 1;
 }
 
+// NOTE(laith): the fds ride along with the bytes and come out on the other side as new fds
+// referring to the same files. the socket has to be a unix socket
+lmp_error lmp_net_send_fds(u32 fd, const u8* data, size_t size, const s32* fds, u32 count) {
+    union {
+        struct cmsghdr header;
+        u8 buffer[CMSG_SPACE(sizeof(s32) * LMP_SHM_FD_COUNT)];
+    } control;
+
+    if (count == 0 || count > LMP_SHM_FD_COUNT) {
+        return LMP_ERR_BAD_INPUT;
+    }
+
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = {(void*)data, size};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(s32) * count);
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(s32) * count);
+    memcpy(CMSG_DATA(header), fds, sizeof(s32) * count);
+
+    for (;;) {
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // NOTE(laith): the fds went with the first byte, the rest can not be sent again with them
+        return sent == (ssize_t)size ? LMP_ERR_NONE : LMP_ERR_CLOSED;
+    }
+}
+
+// NOTE(laith): count holds how many fds fit in fds and comes back as how many arrived, any more
+// than that are closed. result->size is the number of bytes read into buffer
+lmp_error lmp_net_recv_fds(u32 fd, u8* buffer, size_t size, s32* fds, u32* count, lmp_result* result) {
+    union {
+        struct cmsghdr header;
+        u8 buffer[CMSG_SPACE(sizeof(s32) * LMP_SHM_FD_COUNT)];
+    } control;
+
+    lmp_result_init(result);
+
+    struct iovec iov = {buffer, size};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+    do {
+        received = recvmsg(fd, &message, 0);
+    } while (received < 0 && errno == EINTR);
+
+    u32 capacity = *count;
+    *count = 0;
+
+    if (received <= 0) {
+        result->error = received == 0 ? LMP_ERR_CLOSED
+            : (errno == EAGAIN || errno == EWOULDBLOCK) ? LMP_ERR_TIMEOUT : LMP_ERR_CLOSED;
+        return result->error;
+    }
+
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        u32 arrived = (header->cmsg_len - CMSG_LEN(0)) / sizeof(s32);
+        s32 passed[LMP_SHM_FD_COUNT];
+        memcpy(passed, CMSG_DATA(header), sizeof(s32) * MIN(arrived, LMP_SHM_FD_COUNT));
+
+        for (u32 i = 0; i < arrived && i < LMP_SHM_FD_COUNT; i++) {
+            if (*count < capacity) {
+                fds[(*count)++] = passed[i];
+            } else {
+                close(passed[i]);
+            }
+        }
+    }
+
+    result->size = received;
+    return LMP_ERR_NONE;
+}
+
+// ===============================================================
+// Shm
+// ===============================================================
+
+static void lmp_shm_wake(s32 fd) {
+    u64 one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+static void lmp_shm_reset(lmp_shm_channel* channel) {
+    channel->region = NULL;
+    channel->in = NULL;
+    channel->out = NULL;
+    channel->eventFd = -1;
+    channel->peerEventFd = -1;
+    channel->wakeups = 0;
+    for (u32 i = 0; i < LMP_SHM_FD_COUNT; i++) {
+        channel->fds[i] = -1;
+    }
+}
+
+static lmp_error lmp_shm_map(lmp_shm_channel* channel) {
+    void* region = mmap(NULL, sizeof(lmp_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED,
+                        channel->fds[LMP_SHM_FD_REGION], 0);
+    if (region == MAP_FAILED) {
+        return LMP_ERR_BAD_INPUT;
+    }
+
+    channel->region = region;
+    return LMP_ERR_NONE;
+}
+
+// NOTE(laith): the region is sealed at its size before anyone else sees it, a service shrinking it
+// under admiral would otherwise kill admiral with a SIGBUS. a new memfd is zero filled, which is
+// both rings empty and nobody waiting
+lmp_error lmp_shm_create(lmp_shm_channel* channel) {
+    lmp_shm_reset(channel);
+
+#if OS_LINUX
+    channel->fds[LMP_SHM_FD_REGION] = memfd_create("lmp-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    channel->fds[LMP_SHM_FD_SERVICE_EVENT] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel->fds[LMP_SHM_FD_ADMIRAL_EVENT] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    s32 regionFd = channel->fds[LMP_SHM_FD_REGION];
+    if (regionFd == -1 || channel->fds[LMP_SHM_FD_SERVICE_EVENT] == -1 || channel->fds[LMP_SHM_FD_ADMIRAL_EVENT] == -1
+        || ftruncate(regionFd, sizeof(lmp_shm_region)) == -1
+        || fcntl(regionFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1
+        || lmp_shm_map(channel) != LMP_ERR_NONE) {
+        lmp_shm_destroy(channel);
+        return LMP_ERR_BAD_INPUT;
+    }
+
+    channel->in = &channel->region->toAdmiral;
+    channel->out = &channel->region->toService;
+    channel->eventFd = channel->fds[LMP_SHM_FD_ADMIRAL_EVENT];
+    channel->peerEventFd = channel->fds[LMP_SHM_FD_SERVICE_EVENT];
+
+    return LMP_ERR_NONE;
+#else
+    return LMP_ERR_BAD_INPUT;
+#endif
+}
+
+// NOTE(laith): takes ownership of the fds admiral passed, they are closed by lmp_shm_destroy
+lmp_error lmp_shm_attach(lmp_shm_channel* channel, const s32* fds) {
+    lmp_shm_reset(channel);
+    memcpy(channel->fds, fds, sizeof(channel->fds));
+
+    struct stat info;
+    if (fstat(channel->fds[LMP_SHM_FD_REGION], &info) == -1 || (size_t)info.st_size < sizeof(lmp_shm_region)
+        || lmp_shm_map(channel) != LMP_ERR_NONE) {
+        lmp_shm_destroy(channel);
+        return LMP_ERR_BAD_INPUT;
+    }
+
+    channel->in = &channel->region->toService;
+    channel->out = &channel->region->toAdmiral;
+    channel->eventFd = channel->fds[LMP_SHM_FD_SERVICE_EVENT];
+    channel->peerEventFd = channel->fds[LMP_SHM_FD_ADMIRAL_EVENT];
+
+    return LMP_ERR_NONE;
+}
+
+void lmp_shm_destroy(lmp_shm_channel* channel) {
+    if (channel->region) {
+        munmap(channel->region, sizeof(lmp_shm_region));
+    }
+
+    for (u32 i = 0; i < LMP_SHM_FD_COUNT; i++) {
+        if (channel->fds[i] != -1) {
+            close(channel->fds[i]);
+        }
+    }
+
+    lmp_shm_reset(channel);
+}
+
+// NOTE(laith): the other side can scribble over head and tail, so what they claim is clamped to
+// the ring and a broken peer only ever gets garbage bytes back, never a write outside the region
+size_t lmp_shm_write(lmp_shm_channel* channel, const u8* data, size_t size) {
+    lmp_shm_ring* ring = channel->out;
+
+    u32 tail = ring->tail;
+    u32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t room = LMP_SHM_RING_CAPACITY - MIN(tail - head, LMP_SHM_RING_CAPACITY);
+
+    // NOTE(laith): flagged first and checked again after, otherwise the reader could free up room
+    // in between and never know to wake this side
+    if (room < size) {
+        __atomic_store_n(&ring->writerWaiting, 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        room = LMP_SHM_RING_CAPACITY - MIN(tail - head, LMP_SHM_RING_CAPACITY);
+    }
+
+    size_t n = MIN(size, room);
+    if (n == 0) {
+        return 0;
+    }
+
+    size_t offset = tail & (LMP_SHM_RING_CAPACITY - 1);
+    size_t first = MIN(n, LMP_SHM_RING_CAPACITY - offset);
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, n - first);
+
+    __atomic_store_n(&ring->tail, tail + (u32)n, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->readerWaiting, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&ring->readerWaiting, 0, __ATOMIC_ACQ_REL)) {
+        lmp_shm_wake(channel->peerEventFd);
+    }
+
+    return n;
+}
+
+size_t lmp_shm_read(lmp_shm_channel* channel, u8* buffer, size_t size) {
+    lmp_shm_ring* ring = channel->in;
+
+    u32 head = ring->head;
+    u32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t available = MIN(tail - head, LMP_SHM_RING_CAPACITY);
+
+    size_t n = MIN(size, available);
+    if (n == 0) {
+        return 0;
+    }
+
+    size_t offset = head & (LMP_SHM_RING_CAPACITY - 1);
+    size_t first = MIN(n, LMP_SHM_RING_CAPACITY - offset);
+    memcpy(buffer, ring->data + offset, first);
+    memcpy(buffer + first, ring->data, n - first);
+
+    __atomic_store_n(&ring->head, head + (u32)n, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->writerWaiting, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&ring->writerWaiting, 0, __ATOMIC_ACQ_REL)) {
+        lmp_shm_wake(channel->peerEventFd);
+    }
+
+    return n;
+}
+
+s8 lmp_shm_park(lmp_shm_channel* channel) {
+    lmp_shm_ring* ring = channel->in;
+
+    __atomic_store_n(&ring->readerWaiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != ring->head) {
+        __atomic_store_n(&ring->readerWaiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+void lmp_shm_drain(lmp_shm_channel* channel) {
+    u64 count;
+    while (read(channel->eventFd, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
+
+lmp_error lmp_shm_wait(lmp_shm_channel* channel, u32 socketFd, u64 deadline) {
+#ifdef POLLRDHUP
+    short hangup = POLLRDHUP;
+#else
+    short hangup = 0;
+#endif
+
+    struct pollfd fds[2] = {
+        {channel->eventFd, POLLIN, 0},
+        {socketFd, hangup, 0},
+    };
+
+    int timeout = -1;
+    if (deadline != LMP_NET_NO_DEADLINE) {
+        u64 now = lmp_net_now_ms();
+        timeout = now >= deadline ? 0 : (int)(deadline - now);
+    }
+
+    int ready = poll(fds, 2, timeout);
+    if (ready < 0) {
+        return errno == EINTR ? LMP_ERR_NONE : LMP_ERR_CLOSED;
+    }
+
+    if (ready == 0) {
+        return LMP_ERR_TIMEOUT;
+    }
+
+    if (fds[1].revents & (hangup | POLLHUP | POLLERR)) {
+        return LMP_ERR_CLOSED;
+    }
+
+    lmp_shm_drain(channel);
+    return LMP_ERR_NONE;
+}
+
+// ===============================================================
+// Stream
+// ===============================================================
+
+static const u8 lmp_stream_terminate = LMP_PACKET_TERMINATE;
+
+lmp_error lmp_stream_send(u32 fd, const u8* envelope, size_t envelope_length, u16 stream_id,
+                          const u8* data, size_t length, lmp_result* result) {
+    lmp_result_init(result);
+
+    if (!data || length == 0 || length > LMP_STREAM_MAX_SIZE
+        || envelope_length + LMP_FRAGMENT_HEADER_SIZE >= LMP_PACKET_V3_PAYLOAD_MAX_SIZE) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return result->error;
+    }
+
+    size_t chunk_max = LMP_PACKET_V3_PAYLOAD_MAX_SIZE - envelope_length - LMP_FRAGMENT_HEADER_SIZE;
+
+    u8 headers[LMP_STREAM_SEND_BATCH][LMP_PACKET_HEADER_MAX_SIZE + LMP_FRAGMENT_HEADER_SIZE];
+    struct iovec iov[LMP_STREAM_SEND_BATCH * 5];
+
+    size_t offset = 0;
+    while (offset < length) {
+        int count = 0;
+
+        for (u32 f = 0; f < LMP_STREAM_SEND_BATCH && offset < length; f++) {
+            size_t chunk = MIN(chunk_max, length - offset);
+
+            lmp_fragment fragment = {stream_id, (u32)offset, (u32)length, data + offset, chunk};
+
+            // NOTE(laith): the payload is split across the envelope, fragment header and chunk,
+            // the packet only needs a payload pointer and the combined length to be validated
+            lmp_packet packet;
+            lmp_packet_init(&packet);
+            packet.version = LMP_VERSION_3;
+            packet.type = LMP_TYPE_SEND;
+            packet.arg = LMP_ARG_SEND_FRAGMENT;
+            packet.payload = data + offset;
+            packet.payload_length = envelope_length + LMP_FRAGMENT_HEADER_SIZE + chunk;
+
+            u8* packetHeader = headers[f];
+            u8* fragmentHeader = headers[f] + LMP_PACKET_V3_HEADER_SIZE;
+
+            lmp_packet_serialize_header(packetHeader, &packet, result);
+            if (result->error != LMP_ERR_NONE) {
+                return result->error;
+            }
+
+            lmp_fragment_serialize_header(fragmentHeader, &fragment);
+
+            if (envelope_length) {
+                iov[count++] = (struct iovec){packetHeader, LMP_PACKET_V3_HEADER_SIZE};
+                iov[count++] = (struct iovec){(void*)envelope, envelope_length};
+                iov[count++] = (struct iovec){fragmentHeader, LMP_FRAGMENT_HEADER_SIZE};
+            } else {
+                iov[count++] = (struct iovec){packetHeader, LMP_PACKET_V3_HEADER_SIZE + LMP_FRAGMENT_HEADER_SIZE};
+            }
+
+            iov[count++] = (struct iovec){(void*)(data + offset), chunk};
+            iov[count++] = (struct iovec){(void*)&lmp_stream_terminate, 1};
+
+            offset += chunk;
+        }
+
+        result->error = lmp_net_writev_all(fd, iov, count, offset < length ? MSG_MORE : 0,
+                                           lmp_net_deadline(LMP_NET_SEND_TIMEOUT_MS));
+        if (result->error != LMP_ERR_NONE) {
+            return result->error;
+        }
+    }
+
+    result->size = length;
+    return result->error;
+}
+
+void lmp_stream_reassembler_init(lmp_stream_reassembler* reassembler, mem_arena* arena) {
+    reassembler->arena = arena;
+    memset(reassembler->streams, 0, sizeof(reassembler->streams));
+}
+
+// NOTE(laith): the slot is free again right away. the arena space only comes back when the stream
+// was the last thing pushed, otherwise it is gone until the caller clears the arena
+static void lmp_stream_drop(lmp_stream_reassembler* reassembler, lmp_stream* stream) {
+    if ((u8*)reassembler->arena + reassembler->arena->pos == stream->data + stream->total) {
+        arena_pop(reassembler->arena, (u64)(stream->data - (u8*)reassembler->arena));
+    }
+
+    stream->active = 0;
+}
+
+// NOTE(laith): fragments of a stream come down one connection, so they have to show up in order.
+// anything out of order or too big drops the stream
+lmp_error lmp_stream_reassemble(lmp_stream_reassembler* reassembler, const lmp_packet* packet,
+                                u8** data, size_t* length, lmp_result* result) {
+    u64 now = lmp_net_now_ms();
+    for (u32 i = 0; i < LMP_STREAM_MAX_ACTIVE; i++) {
+        lmp_stream* s = &reassembler->streams[i];
+        if (s->active && now - s->lastActivity > LMP_STREAM_IDLE_TIMEOUT_MS) {
+            lmp_stream_drop(reassembler, s);
+        }
+    }
+
+    lmp_fragment fragment;
+    lmp_fragment_deserialize(packet->payload, packet->payload_length, &fragment, result);
+    if (result->error != LMP_ERR_NONE) {
+        return result->error;
+    }
+
+    lmp_stream* stream = NULL;
+    lmp_stream* available = NULL;
+    for (u32 i = 0; i < LMP_STREAM_MAX_ACTIVE; i++) {
+        lmp_stream* s = &reassembler->streams[i];
+        if (s->active && s->id == fragment.stream_id) {
+            stream = s;
+            break;
+        }
+
+        if (!s->active && !available) {
+            available = s;
+        }
+    }
+
+    if (fragment.total > LMP_STREAM_MAX_SIZE) {
+        if (stream) {
+            lmp_stream_drop(reassembler, stream);
+        }
+
+        result->error = LMP_ERR_BAD_SIZE;
+        return result->error;
+    }
+
+    // NOTE(laith): a stream that comes in again from its first fragment starts over, that is how
+    // admiral resends one it only got partway out before the connection broke
+    if (stream && fragment.offset == 0 && stream->received > 0) {
+        lmp_stream_drop(reassembler, stream);
+        available = stream;
+        stream = NULL;
+    }
+
+    if (!stream) {
+        if (fragment.offset != 0 || !available) {
+            result->error = LMP_ERR_BAD_PAYLOAD;
+            return result->error;
+        }
+
+        u8* buffer = arena_push(reassembler->arena, fragment.total);
+        if (!buffer) {
+            result->error = LMP_ERR_BAD_SIZE;
+            return result->error;
+        }
+
+        stream = available;
+        stream->id = fragment.stream_id;
+        stream->active = 1;
+        stream->data = buffer;
+        stream->total = fragment.total;
+        stream->received = 0;
+    }
+
+    if (fragment.offset != stream->received || fragment.total != stream->total
+        || fragment.data_length > stream->total - stream->received) {
+        lmp_stream_drop(reassembler, stream);
+        result->error = LMP_ERR_BAD_PAYLOAD;
+        return result->error;
+    }
+
+    stream->lastActivity = now;
+
+    memcpy(stream->data + fragment.offset, fragment.data, fragment.data_length);
+    stream->received += fragment.data_length;
+
+    if (stream->received < stream->total) {
+        result->error = LMP_ERR_INCOMPLETE;
+        return result->error;
+    }
+
+    stream->active = 0;
+    *data = stream->data;
+    *length = stream->total;
+
+    result->size = stream->total;
+    return result->error;
+}
+
+// ===============================================================
+// Log
+// ===============================================================
+
+const char* lmp_log_print_type_colors[] = {
+    LMP_LOG_COLOR_INFO,
+    LMP_LOG_COLOR_WARN,
+    LMP_LOG_COLOR_ERROR
+};
+
+static const char* lmp_log_print_type_names[] = {
+    "INFO",
+    "WARN",
+    "ERROR"
+};
+
+lmp_log_print_type lmp_log_level = LMP_PRINT_TYPE_INFO;
+
+// NOTE(laith): one per thread that has logged. the thread is the only writer of tail and the
+// flusher the only writer of head. rings are never freed, a thread that exits hands its ring back
+// through owned and the next new thread picks it up
+typedef struct lmp_log_ring {
+    u32 head __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u32 tail __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u64 dropped;
+    u32 owned;
+    struct lmp_log_ring* next;
+    lmp_log_record records[LMP_LOG_RING_RECORDS];
+} lmp_log_ring;
+
+static lmp_log_ring* lmp_log_rings = NULL;
+static __thread lmp_log_ring* lmp_log_thread_ring = NULL;
+static pthread_key_t lmp_log_ring_key;
+static pthread_once_t lmp_log_once = PTHREAD_ONCE_INIT;
+
+// NOTE(laith): the flusher thread and lmp_log_flush both drain, this keeps it to one at a time.
+// the threads logging never touch it
+static pthread_mutex_t lmp_log_drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static u8 lmp_log_binary = 0;
+static u8 lmp_log_binary_started = 0;
+static u64 lmp_log_lost = 0;
+static u64 lmp_log_dropped_total = 0;
+
+// NOTE(laith): the flusher sleeps on wake until the first record after a drain sets pending
+static pthread_mutex_t lmp_log_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lmp_log_wake = PTHREAD_COND_INITIALIZER;
+static u32 lmp_log_pending = 0;
+
+// NOTE(laith): the flags, width and precision of a conversion are kept as written, the length
+// modifier is read into hs and ls so both sides of the ring agree on the argument type
+typedef struct {
+    const char* start;
+    size_t prefixLength;
+    u8 hs;
+    u8 ls;
+    char size;
+    char conversion;
+} lmp_log_spec;
+
+// NOTE(laith): c points just past a '%', returns the character after the conversion
+static const char* lmp_log_parse_spec(const char* c, lmp_log_spec* spec) {
+    spec->start = c - 1;
+    spec->hs = 0;
+    spec->ls = 0;
+    spec->size = 0;
+
+    while (*c && strchr("-+ #0", *c)) c++;
+    while (*c >= '0' && *c <= '9') c++;
+    if (*c == '.') {
+        c++;
+        while (*c >= '0' && *c <= '9') c++;
+    }
+
+    spec->prefixLength = c - spec->start;
+
+    for (; *c && strchr("hlzjt", *c); c++) {
+        if (*c == 'h') spec->hs++;
+        else if (*c == 'l') spec->ls++;
+        else spec->size = *c;
+    }
+
+    spec->conversion = *c;
+    return *c ? c + 1 : c;
+}
+
+static void lmp_log_capture(lmp_log_record* record, const char* format, va_list args) {
+    size_t used = 0;
+    record->argCount = 0;
+
+    for (const char* c = format; *c;) {
+        if (*c++ != '%') {
+            continue;
+        }
+
+        if (*c == '%') {
+            c++;
+            continue;
+        }
+
+        lmp_log_spec spec;
+        c = lmp_log_parse_spec(c, &spec);
+        if (record->argCount == LMP_LOG_RECORD_ARGS) {
+            return;
+        }
+
+        u8 i = record->argCount;
+        switch (spec.conversion) {
+            case 'd':
+            case 'i': {
+                s64 value;
+                if (spec.size == 'z') value = va_arg(args, ssize_t);
+                else if (spec.size == 'j') value = va_arg(args, intmax_t);
+                else if (spec.size == 't') value = va_arg(args, ptrdiff_t);
+                else if (spec.ls >= 2) value = va_arg(args, long long);
+                else if (spec.ls == 1) value = va_arg(args, long);
+                else value = va_arg(args, int);
+
+                if (spec.hs >= 2) value = (signed char)value;
+                else if (spec.hs == 1) value = (short)value;
+
+                record->argTypes[i] = LMP_LOG_ARG_INT;
+                record->args[i] = (u64)value;
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c': {
+                u64 value;
+                if (spec.size == 'z') value = va_arg(args, size_t);
+                else if (spec.size == 'j') value = va_arg(args, uintmax_t);
+                else if (spec.size == 't') value = va_arg(args, ptrdiff_t);
+                else if (spec.ls >= 2) value = va_arg(args, unsigned long long);
+                else if (spec.ls == 1) value = va_arg(args, unsigned long);
+                else value = va_arg(args, unsigned int);
+
+                if (spec.hs >= 2 || spec.conversion == 'c') value = (unsigned char)value;
+                else if (spec.hs == 1) value = (unsigned short)value;
+
+                record->argTypes[i] = LMP_LOG_ARG_UINT;
+                record->args[i] = value;
+                break;
+            }
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G': {
+                f64 value = va_arg(args, f64);
+                record->argTypes[i] = LMP_LOG_ARG_DOUBLE;
+                memcpy(&record->args[i], &value, sizeof(value));
+                break;
+            }
+            case 's': {
+                const char* value = va_arg(args, const char*);
+                if (value == NULL) {
+                    value = "(null)";
+                }
+
+                size_t length = MIN(strlen(value), sizeof(record->strings) - used - 1);
+                memcpy(record->strings + used, value, length);
+                record->strings[used + length] = '\0';
+
+                record->argTypes[i] = LMP_LOG_ARG_STRING;
+                record->args[i] = used;
+                used = MIN(used + length + 1, sizeof(record->strings) - 1);
+                break;
+            }
+            case 'p':
+                record->argTypes[i] = LMP_LOG_ARG_POINTER;
+                record->args[i] = (uintptr_t)va_arg(args, void*);
+                break;
+            default:
+                // NOTE(laith): anything else, like '*' widths, would leave the arguments after it
+                // misread, so the record stops here and the rest prints as written
+                return;
+        }
+
+        record->argCount++;
+    }
+}
+
+// NOTE(laith): the conversion is rebuilt with its flags, width and precision but the length
+// modifier swapped for the type the argument was kept as
+static size_t lmp_log_format_arg(const lmp_log_record* record, u8 i, const lmp_log_spec* spec,
+                                 char* buffer, size_t size) {
+    char conversion[32];
+    size_t prefix = MIN(spec->prefixLength, sizeof(conversion) - 4);
+    memcpy(conversion, spec->start, prefix);
+
+    const char* modifier = "";
+    if ((record->argTypes[i] == LMP_LOG_ARG_INT || record->argTypes[i] == LMP_LOG_ARG_UINT)
+        && spec->conversion != 'c') {
+        modifier = "ll";
+    }
+
+    snprintf(conversion + prefix, sizeof(conversion) - prefix, "%s%c", modifier, spec->conversion);
+
+    int n = 0;
+    f64 d;
+
+    switch (record->argTypes[i]) {
+        case LMP_LOG_ARG_INT:
+            n = snprintf(buffer, size, conversion, (long long)record->args[i]);
+            break;
+        case LMP_LOG_ARG_UINT:
+            n = spec->conversion == 'c'
+                ? snprintf(buffer, size, conversion, (int)record->args[i])
+                : snprintf(buffer, size, conversion, (unsigned long long)record->args[i]);
+            break;
+        case LMP_LOG_ARG_DOUBLE:
+            memcpy(&d, &record->args[i], sizeof(d));
+            n = snprintf(buffer, size, conversion, d);
+            break;
+        case LMP_LOG_ARG_STRING:
+            n = snprintf(buffer, size, conversion, record->strings + MIN(record->args[i], sizeof(record->strings) - 1));
+            break;
+        case LMP_LOG_ARG_POINTER:
+            n = snprintf(buffer, size, conversion, (void*)(uintptr_t)record->args[i]);
+            break;
+    }
+
+    return n < 0 ? 0 : MIN((size_t)n, size - 1);
+}
+
+// NOTE(laith): a record read back from a file can hold anything, so every argument has to be of
+// the type its conversion expects before it goes anywhere near snprintf
+static s8 lmp_log_arg_matches(u8 type, char conversion) {
+    switch (conversion) {
+        case 'd':
+        case 'i':
+            return type == LMP_LOG_ARG_INT;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            return type == LMP_LOG_ARG_UINT;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+            return type == LMP_LOG_ARG_DOUBLE;
+        case 's':
+            return type == LMP_LOG_ARG_STRING;
+        case 'p':
+            return type == LMP_LOG_ARG_POINTER;
+        default:
+            return 0;
+    }
+}
+
+// NOTE(laith): formats a record the way lmp_log_print always has, returns the length written.
+// a line longer than size is cut short but always keeps its color reset and newline. a record
+// whose arguments don't fit its format prints as <bad record>
+size_t lmp_log_format_record(const lmp_log_record* record, char* buffer, size_t size) {
+    static time_t lastSecond = -1;
+    static struct tm lastTime;
+
+    const char* suffix = LMP_LOG_COLOR_RESET "\n";
+    size_t suffixLength = strlen(suffix);
+    if (size <= suffixLength + 1) {
+        return 0;
+    }
+
+    time_t second = record->timestamp / 1000000000ull;
+    if (second != lastSecond) {
+        localtime_r(&second, &lastTime);
+        lastSecond = second;
+    }
+
+    u8 level = MIN(record->level, LMP_PRINT_TYPE_ERROR);
+    size_t limit = size - suffixLength;
+
+    int n = snprintf(buffer, limit, "%s[%s] %02d:%02d:%02d [%s]: ", lmp_log_print_type_colors[level],
+                     record->service, lastTime.tm_hour, lastTime.tm_min, lastTime.tm_sec,
+                     lmp_log_print_type_names[level]);
+    size_t length = n < 0 ? 0 : MIN((size_t)n, limit - 1);
+    size_t header = length;
+
+    u8 arg = 0;
+    for (const char* c = record->format; *c && length < limit - 1;) {
+        if (*c != '%') {
+            buffer[length++] = *c++;
+            continue;
+        }
+
+        c++;
+        if (*c == '%') {
+            buffer[length++] = *c++;
+            continue;
+        }
+
+        lmp_log_spec spec;
+        const char* next = lmp_log_parse_spec(c, &spec);
+
+        if (arg >= record->argCount) {
+            size_t written = MIN((size_t)(next - spec.start), limit - 1 - length);
+            memcpy(buffer + length, spec.start, written);
+            length += written;
+        } else if (!lmp_log_arg_matches(record->argTypes[arg], spec.conversion)) {
+            length = header + MIN(strlen("<bad record>"), limit - 1 - header);
+            memcpy(buffer + header, "<bad record>", length - header);
+            break;
+        } else {
+            length += lmp_log_format_arg(record, arg++, &spec, buffer + length, limit - length);
+        }
+
+        c = next;
+    }
+
+    memcpy(buffer + length, suffix, suffixLength);
+    length += suffixLength;
+    buffer[length] = '\0';
+
+    return length;
+}
+
+static void lmp_log_write_out(const u8* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(STDERR_FILENO, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written <= 0) {
+            return;
+        }
+
+        data += written;
+        length -= written;
+    }
+}
+
+// NOTE(laith): the binary format names each service and format string once with an 'S' entry and
+// refers to it by id after that. everything is in host byte order, see tools/lmplog.c
+#define LMP_LOG_STRING_SLOTS 4096
+
+static const char* lmp_log_string_keys[LMP_LOG_STRING_SLOTS];
+static u16 lmp_log_string_ids[LMP_LOG_STRING_SLOTS];
+static u16 lmp_log_string_count = 0;
+
+typedef struct {
+    u8 data[LMP_LOG_BATCH_SIZE];
+    size_t length;
+} lmp_log_batch;
+
+static void lmp_log_batch_put(lmp_log_batch* batch, const void* data, size_t length) {
+    if (batch->length + length > sizeof(batch->data)) {
+        lmp_log_write_out(batch->data, batch->length);
+        batch->length = 0;
+    }
+
+    memcpy(batch->data + batch->length, data, MIN(length, sizeof(batch->data)));
+    batch->length += MIN(length, sizeof(batch->data));
+}
+
+static u16 lmp_log_intern(lmp_log_batch* batch, const char* string) {
+    u32 slot = (u32)(((uintptr_t)string >> 3) * 2654435761u) & (LMP_LOG_STRING_SLOTS - 1);
+
+    while (lmp_log_string_keys[slot] != NULL) {
+        if (lmp_log_string_keys[slot] == string) {
+            return lmp_log_string_ids[slot];
+        }
+
+        slot = (slot + 1) & (LMP_LOG_STRING_SLOTS - 1);
+    }
+
+    // NOTE(laith): once the table is half full it starts over. the decoder takes the last 'S' entry
+    // for an id, so ids can be handed out again and every string still goes out once per round
+    if (lmp_log_string_count == LMP_LOG_STRING_SLOTS / 2) {
+        memset(lmp_log_string_keys, 0, sizeof(lmp_log_string_keys));
+        lmp_log_string_count = 0;
+        slot = (u32)(((uintptr_t)string >> 3) * 2654435761u) & (LMP_LOG_STRING_SLOTS - 1);
+    }
+
+    u16 id = lmp_log_string_count++;
+    lmp_log_string_keys[slot] = string;
+    lmp_log_string_ids[slot] = id;
+
+    u16 length = MIN(strlen(string), 0xffff);
+    u8 header[5] = {'S'};
+    memcpy(header + 1, &id, sizeof(id));
+    memcpy(header + 3, &length, sizeof(length));
+
+    lmp_log_batch_put(batch, header, sizeof(header));
+    lmp_log_batch_put(batch, string, length);
+
+    return id;
+}
+
+static void lmp_log_encode_record(lmp_log_batch* batch, const lmp_log_record* record) {
+    u16 service = lmp_log_intern(batch, record->service);
+    u16 format = lmp_log_intern(batch, record->format);
+
+    u8 header[15 + LMP_LOG_RECORD_ARGS] = {'R'};
+    memcpy(header + 1, &record->timestamp, sizeof(record->timestamp));
+    header[9] = record->level;
+    memcpy(header + 10, &service, sizeof(service));
+    memcpy(header + 12, &format, sizeof(format));
+    header[14] = record->argCount;
+    memcpy(header + 15, record->argTypes, record->argCount);
+
+    lmp_log_batch_put(batch, header, 15 + record->argCount);
+
+    for (u8 i = 0; i < record->argCount; i++) {
+        if (record->argTypes[i] != LMP_LOG_ARG_STRING) {
+            lmp_log_batch_put(batch, &record->args[i], sizeof(record->args[i]));
+            continue;
+        }
+
+        const char* string = record->strings + MIN(record->args[i], sizeof(record->strings) - 1);
+        u8 length = MIN(strlen(string), 0xff);
+        lmp_log_batch_put(batch, &length, sizeof(length));
+        lmp_log_batch_put(batch, string, length);
+    }
+}
+
+static void lmp_log_emit(lmp_log_batch* batch, const lmp_log_record* record) {
+    if (lmp_log_binary) {
+        lmp_log_encode_record(batch, record);
+        return;
+    }
+
+    char line[LMP_LOG_LINE_SIZE];
+    size_t length = lmp_log_format_record(record, line, sizeof(line));
+    lmp_log_batch_put(batch, line, length);
+}
+
+static u64 lmp_log_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+// NOTE(laith): rings are merged by timestamp so lines from different threads come out in the
+// order they were logged. only what was in the rings when the drain started is taken, a thread
+// logging nonstop can not keep the flusher here forever
+static void lmp_log_drain(void) {
+    static lmp_log_batch batch;
+    batch.length = 0;
+
+    if (lmp_log_binary && !lmp_log_binary_started) {
+        lmp_log_batch_put(&batch, LMP_LOG_BINARY_MAGIC, strlen(LMP_LOG_BINARY_MAGIC));
+        lmp_log_binary_started = 1;
+    }
+
+    u64 dropped = __atomic_exchange_n(&lmp_log_lost, 0, __ATOMIC_RELAXED);
+    lmp_log_ring* rings = __atomic_load_n(&lmp_log_rings, __ATOMIC_ACQUIRE);
+
+    for (lmp_log_ring* ring = rings; ring; ring = ring->next) {
+        dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    }
+
+    for (;;) {
+        lmp_log_ring* oldest = NULL;
+        u64 oldestTimestamp = 0;
+
+        for (lmp_log_ring* ring = rings; ring; ring = ring->next) {
+            u32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            if (ring->head == tail) {
+                continue;
+            }
+
+            u64 timestamp = ring->records[ring->head & (LMP_LOG_RING_RECORDS - 1)].timestamp;
+            if (oldest == NULL || timestamp < oldestTimestamp) {
+                oldest = ring;
+                oldestTimestamp = timestamp;
+            }
+        }
+
+        if (oldest == NULL) {
+            break;
+        }
+
+        lmp_log_emit(&batch, &oldest->records[oldest->head & (LMP_LOG_RING_RECORDS - 1)]);
+        __atomic_store_n(&oldest->head, oldest->head + 1, __ATOMIC_RELEASE);
+    }
+
+    if (dropped > 0) {
+        lmp_log_dropped_total += dropped;
+
+        lmp_log_record record = {0};
+        record.timestamp = lmp_log_now();
+        record.service = "log";
+        record.format = "Dropped %llu log records, the rings were full";
+        record.level = LMP_PRINT_TYPE_WARN;
+        record.argCount = 1;
+        record.argTypes[0] = LMP_LOG_ARG_UINT;
+        record.args[0] = dropped;
+
+        lmp_log_emit(&batch, &record);
+    }
+
+    lmp_log_write_out(batch.data, batch.length);
+}
+
+void lmp_log_flush(void) {
+    pthread_mutex_lock(&lmp_log_drain_mutex);
+    lmp_log_drain();
+    pthread_mutex_unlock(&lmp_log_drain_mutex);
+}
+
+static void* lmp_log_flusher(void* args) {
+    unused(args);
+
+    struct timespec interval = {0, LMP_LOG_FLUSH_INTERVAL_MS * 1000000L};
+
+    for (;;) {
+        pthread_mutex_lock(&lmp_log_wake_mutex);
+        while (!lmp_log_pending) {
+            pthread_cond_wait(&lmp_log_wake, &lmp_log_wake_mutex);
+        }
+        pthread_mutex_unlock(&lmp_log_wake_mutex);
+
+        // NOTE(laith): everything logged while this sleeps goes out with the same batch. pending is
+        // cleared before the drain looks at the rings, so a record it misses wakes it again
+        nanosleep(&interval, NULL);
+        __atomic_store_n(&lmp_log_pending, 0, __ATOMIC_SEQ_CST);
+        lmp_log_flush();
+    }
+
+    return NULL;
+}
+
+static void lmp_log_release_ring(void* ring) {
+    __atomic_store_n(&((lmp_log_ring*)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void lmp_log_init(void) {
+    const char* level = getenv(LMP_LOG_LEVEL_ENV);
+    if (level && strcmp(level, "warn") == 0) {
+        __atomic_store_n(&lmp_log_level, LMP_PRINT_TYPE_WARN, __ATOMIC_RELAXED);
+    } else if (level && strcmp(level, "error") == 0) {
+        __atomic_store_n(&lmp_log_level, LMP_PRINT_TYPE_ERROR, __ATOMIC_RELAXED);
+    }
+
+    const char* format = getenv(LMP_LOG_FORMAT_ENV);
+    lmp_log_binary = format && strcmp(format, "binary") == 0;
+
+    pthread_key_create(&lmp_log_ring_key, lmp_log_release_ring);
+
+    // NOTE(laith): whatever is still in the rings goes out when the process exits normally
+    atexit(lmp_log_flush);
+
+    pthread_t flusher;
+    if (pthread_create(&flusher, NULL, lmp_log_flusher, NULL) == 0) {
+        pthread_detach(flusher);
+    }
+}
+
+static lmp_log_ring* lmp_log_claim_ring(void) {
+    lmp_log_ring* head = __atomic_load_n(&lmp_log_rings, __ATOMIC_ACQUIRE);
+
+    // NOTE(laith): a ring handed back is only taken once the flusher has emptied it, otherwise the
+    // new thread would start out with the last one's backlog
+    for (lmp_log_ring* ring = head; ring; ring = ring->next) {
+        u32 free = 0;
+        if (__atomic_load_n(&ring->owned, __ATOMIC_RELAXED) == 0
+            && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail
+            && __atomic_compare_exchange_n(&ring->owned, &free, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return ring;
+        }
+    }
+
+    lmp_log_ring* ring = NULL;
+    if (posix_memalign((void**)&ring, LMP_SHM_CACHE_LINE, sizeof(lmp_log_ring)) != 0) {
+        return NULL;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->owned = 1;
+
+    do {
+        ring->next = head;
+    } while (!__atomic_compare_exchange_n(&lmp_log_rings, &head, ring, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    return ring;
+}
+
+void lmp_log_write(lmp_log_print_type type, const char* service, const char* format, ...) {
+    pthread_once(&lmp_log_once, lmp_log_init);
+
+    if (type < __atomic_load_n(&lmp_log_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    lmp_log_ring* ring = lmp_log_thread_ring;
+    if (ring == NULL) {
+        ring = lmp_log_claim_ring();
+        if (ring == NULL) {
+            __atomic_add_fetch(&lmp_log_lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        lmp_log_thread_ring = ring;
+        pthread_setspecific(lmp_log_ring_key, ring);
+    }
+
+    u32 tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= LMP_LOG_RING_RECORDS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    lmp_log_record* record = &ring->records[tail & (LMP_LOG_RING_RECORDS - 1)];
+    record->timestamp = lmp_log_now();
+    record->service = service;
+    record->format = format;
+    record->level = type;
+
+    va_list args;
+    va_start(args, format);
+    lmp_log_capture(record, format, args);
+    va_end(args);
+
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&lmp_log_pending, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&lmp_log_wake_mutex);
+        lmp_log_pending = 1;
+        pthread_cond_signal(&lmp_log_wake);
+        pthread_mutex_unlock(&lmp_log_wake_mutex);
+    }
+}
+
+void lmp_log_print(const char* service, const char* message, lmp_log_print_type type) {
+    LMP_LOG(type, service, "%s", message);
+}
+
+void lmp_log_set_level(lmp_log_print_type type) {
+    pthread_once(&lmp_log_once, lmp_log_init);
+    __atomic_store_n(&lmp_log_level, type, __ATOMIC_RELAXED);
+}
+
+u64 lmp_log_dropped(void) {
+    pthread_mutex_lock(&lmp_log_drain_mutex);
+    u64 dropped = lmp_log_dropped_total;
+    pthread_mutex_unlock(&lmp_log_drain_mutex);
+
+    return dropped;
+}
+
+// ===============================================================
+// Admiral
+// ===============================================================
+
+char* lmp_admiral_endpoints[] = {
+    "admiral",
+    "hotel",
+    "scheduler",
+};
+
+// NOTE(laith): a full ring starts out with every index pushed once already
+static void lmp_admiral_ring_init(lmp_admiral_queue_ring* ring, lmp_admiral_queue_cell* cells, u64 size, u8 full) {
+    for (u64 i = 0; i < size; i++) {
+        cells[i].sequence = full ? i + 1 : i;
+        cells[i].index = (u32)i;
+    }
+
+    ring->cells = cells;
+    ring->mask = size - 1;
+    ring->popPosition = 0;
+    ring->pushPosition = full ? size : 0;
+}
+
+// NOTE(laith): claims the cell at *position for a push when ahead is 0 or a pop when it is 1, NULL
+// when the ring is full or empty respectively
+static lmp_admiral_queue_cell* lmp_admiral_ring_claim(lmp_admiral_queue_ring* ring, u64* position, u64 ahead, u64* claimed) {
+    u64 current = __atomic_load_n(position, __ATOMIC_RELAXED);
+
+    for (;;) {
+        lmp_admiral_queue_cell* cell = &ring->cells[current & ring->mask];
+        u64 sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        s64 difference = (s64)(sequence - (current + ahead));
+
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(position, &current, current + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *claimed = current;
+                return cell;
+            }
+        } else if (difference < 0) {
+            return NULL;
+        } else {
+            current = __atomic_load_n(position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static s64 lmp_admiral_ring_pop(lmp_admiral_queue_ring* ring) {
+    u64 position;
+    lmp_admiral_queue_cell* cell = lmp_admiral_ring_claim(ring, &ring->popPosition, 1, &position);
+    if (cell == NULL) {
+        return -1;
+    }
+
+    u32 index = cell->index;
+    __atomic_store_n(&cell->sequence, position + ring->mask + 1, __ATOMIC_RELEASE);
+
+    return index;
+}
+
+// NOTE(laith): every ring has a cell for each index there is, so a push can only find its cell
+// taken for the moment a pop of it is still finishing
+static void lmp_admiral_ring_push(lmp_admiral_queue_ring* ring, u32 index) {
+    u64 position;
+    lmp_admiral_queue_cell* cell;
+    while ((cell = lmp_admiral_ring_claim(ring, &ring->pushPosition, 0, &position)) == NULL) {}
+
+    cell->index = index;
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+s8 lmp_admiral_queue_init(lmp_admiral_queue* queue, u32 capacity, const char* spillPath) {
+#if OS_LINUX
+    queue->waitFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    queue->wakeFd = queue->waitFd;
+    if (queue->waitFd == -1) {
+        return -1;
+    }
+#else
+    s32 fds[2];
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+
+    for (u32 i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    queue->waitFd = fds[0];
+    queue->wakeFd = fds[1];
+#endif
+
+    queue->spillFd = -1;
+    if (spillPath && (queue->spillFd = open(spillPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1) {
+        if (queue->wakeFd != queue->waitFd) {
+            close(queue->wakeFd);
+        }
+
+        close(queue->waitFd);
+        return -1;
+    }
+
+    u64 slots = 1;
+    while (slots < MIN(capacity, ADMIRAL_QUEUE_MAX_CAPACITY)) {
+        slots <<= 1;
+    }
+
+    u64 large = MAX(slots / ADMIRAL_QUEUE_LARGE_SHARE, 1);
+
+    // NOTE(laith): arena_push only aligns to a pointer, the extra line lets the slots start on one
+    u64 slotBytes = slots * sizeof(lmp_admiral_queue_slot) + LMP_SHM_CACHE_LINE;
+    u64 largeBytes = large * LMP_PACKET_PAYLOAD_MAX_SIZE;
+    u64 cellBytes = (2 * slots + large) * sizeof(lmp_admiral_queue_cell);
+
+    queue->arena = arena_create(slotBytes + largeBytes + cellBytes + KiB(4));
+    if (queue->arena == NULL) {
+        return -1;
+    }
+
+    u8* memory = arena_push(queue->arena, slotBytes);
+
+    queue->slots = (lmp_admiral_queue_slot*)arena_align_forward((uintptr_t)memory, LMP_SHM_CACHE_LINE);
+    queue->large = arena_push(queue->arena, largeBytes);
+
+    lmp_admiral_ring_init(&queue->ready, arena_push(queue->arena, slots * sizeof(lmp_admiral_queue_cell)), slots, 0);
+    lmp_admiral_ring_init(&queue->freeSlots, arena_push(queue->arena, slots * sizeof(lmp_admiral_queue_cell)), slots, 1);
+    lmp_admiral_ring_init(&queue->freeLarge, arena_push(queue->arena, large * sizeof(lmp_admiral_queue_cell)), large, 1);
+
+    memset(queue->shares, 0, sizeof(queue->shares));
+    queue->shareSlots = (u32)MAX(slots / ADMIRAL_QUEUE_DESTINATION_SHARE, 1);
+    queue->shareLarge = (u32)MAX(large / ADMIRAL_QUEUE_DESTINATION_SHARE, 1);
+
+    queue->consumerWaiting = 0;
+    queue->spilling = 0;
+    queue->spillRead = 0;
+    queue->spillWrite = 0;
+    pthread_mutex_init(&queue->spillMutex, NULL);
+    queue->wal = NULL;
+    pthread_mutex_init(&queue->abortMutex, NULL);
+    queue->abortCount = 0;
+
+    return 1;
+}
+
+void lmp_admiral_queue_destroy(lmp_admiral_queue* queue) {
+    if (queue->wakeFd != queue->waitFd) {
+        close(queue->wakeFd);
+    }
+
+    if (queue->spillFd != -1) {
+        close(queue->spillFd);
+    }
+
+    close(queue->waitFd);
+    pthread_mutex_destroy(&queue->spillMutex);
+    pthread_mutex_destroy(&queue->abortMutex);
+    arena_destroy(queue->arena);
+}
+
+static s8 lmp_admiral_queue_push(lmp_admiral_queue* queue, const lmp_admiral_message* message) {
+    s64 large = -1;
+    if (message->packet.payload_length > ADMIRAL_QUEUE_INLINE_PAYLOAD
+        && (large = lmp_admiral_ring_pop(&queue->freeLarge)) == -1) {
+        return -1;
+    }
+
+    s64 index = lmp_admiral_ring_pop(&queue->freeSlots);
+    if (index == -1) {
+        if (large != -1) {
+            lmp_admiral_ring_push(&queue->freeLarge, (u32)large);
+        }
+
+        return -1;
+    }
+
+    lmp_admiral_queue_slot* slot = &queue->slots[index];
+    u8* payload = large == -1 ? slot->payload : queue->large[large];
+    memcpy(payload, message->packet.payload, message->packet.payload_length);
+
+    slot->message = *message;
+    slot->message.packet.payload = payload;
+    slot->large = (u32)(large + 1);
+
+    lmp_admiral_ring_push(&queue->ready, (u32)index);
+
+    return 1;
+}
+
+// NOTE(laith): counts the message against its destination's share, -1 when that is used up
+static s8 lmp_admiral_queue_admit(lmp_admiral_queue* queue, const lmp_admiral_message* message) {
+    lmp_admiral_queue_share* share = &queue->shares[message->destinationId];
+
+    if (__atomic_add_fetch(&share->slots, 1, __ATOMIC_RELAXED) > queue->shareSlots) {
+        __atomic_sub_fetch(&share->slots, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    if (message->packet.payload_length > ADMIRAL_QUEUE_INLINE_PAYLOAD
+        && __atomic_add_fetch(&share->large, 1, __ATOMIC_RELAXED) > queue->shareLarge) {
+        __atomic_sub_fetch(&share->large, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&share->slots, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    return 1;
+}
+
+static void lmp_admiral_queue_dismiss(lmp_admiral_queue* queue, u8 destination, u8 large) {
+    lmp_admiral_queue_share* share = &queue->shares[destination];
+
+    __atomic_sub_fetch(&share->slots, 1, __ATOMIC_RELAXED);
+    if (large) {
+        __atomic_sub_fetch(&share->large, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// NOTE(laith): [u8 destination][u8 sender][u16 length][u64 wal record][u8 large][the packet as it
+// came off the wire]. large says whether the message counts against its destination's large buffers
+#define ADMIRAL_QUEUE_SPILL_HEADER 13
+
+static s8 lmp_admiral_queue_spill(lmp_admiral_queue* queue, const lmp_admiral_message* message) {
+    u8 record[ADMIRAL_QUEUE_SPILL_HEADER + LMP_PACKET_MAX_SIZE];
+    lmp_result result;
+
+    lmp_packet_serialize(record + ADMIRAL_QUEUE_SPILL_HEADER, LMP_PACKET_MAX_SIZE, &message->packet, &result);
+    if (result.error != LMP_ERR_NONE) {
+        return -1;
+    }
+
+    u16 length = (u16)result.size;
+    record[0] = message->destinationId;
+    record[1] = message->senderId;
+    memcpy(record + 2, &length, sizeof(length));
+    memcpy(record + 4, &message->walRecord, sizeof(message->walRecord));
+    record[12] = message->packet.payload_length > ADMIRAL_QUEUE_INLINE_PAYLOAD;
+
+    size_t size = ADMIRAL_QUEUE_SPILL_HEADER + length;
+
+    pthread_mutex_lock(&queue->spillMutex);
+
+    if (pwrite(queue->spillFd, record, size, queue->spillWrite) != (ssize_t)size) {
+        pthread_mutex_unlock(&queue->spillMutex);
+        return -1;
+    }
+
+    queue->spillWrite += size;
+    if (__atomic_exchange_n(&queue->spilling, 1, __ATOMIC_SEQ_CST) == 0) {
+        LMP_LOG_WARN("admiral", "Queue is full, spilling messages to disk");
+    }
+
+    pthread_mutex_unlock(&queue->spillMutex);
+
+    return 1;
+}
+
+// NOTE(laith): moves spilled messages back into the ring oldest first for as long as there is room.
+// once the file is empty it starts over from the beginning and producers go back to the ring
+static void lmp_admiral_queue_unspill(lmp_admiral_queue* queue) {
+    pthread_mutex_lock(&queue->spillMutex);
+
+    while (queue->spillRead < queue->spillWrite) {
+        u8 record[ADMIRAL_QUEUE_SPILL_HEADER + LMP_PACKET_MAX_SIZE];
+        u16 length = 0;
+
+        if (pread(queue->spillFd, record, ADMIRAL_QUEUE_SPILL_HEADER, queue->spillRead) == ADMIRAL_QUEUE_SPILL_HEADER) {
+            memcpy(&length, record + 2, sizeof(length));
+        }
+
+        lmp_result result;
+        lmp_admiral_message message = {record[0], record[1], {0}, NULL, 0, 0};
+        memcpy(&message.walRecord, record + 4, sizeof(message.walRecord));
+
+        if (length == 0 || length > LMP_PACKET_MAX_SIZE
+            || pread(queue->spillFd, record + ADMIRAL_QUEUE_SPILL_HEADER, length,
+                     queue->spillRead + ADMIRAL_QUEUE_SPILL_HEADER) != length) {
+            LMP_LOG_ERROR("admiral", "Could not read back the spill file, dropping %llu bytes of messages",
+                          (unsigned long long)(queue->spillWrite - queue->spillRead));
+            queue->spillRead = queue->spillWrite;
+            break;
+        }
+
+        // NOTE(laith): a record that does not come back is dropped like a released message, so its
+        // share is freed and the log does not bring it back on a restart either
+        lmp_packet_deserialize(record + ADMIRAL_QUEUE_SPILL_HEADER, length, &message.packet, &result);
+        if (result.error != LMP_ERR_NONE) {
+            LMP_LOG_ERROR("admiral", "Dropping a spilled message from [%u] to [%u] that did not read back (error %d)",
+                          message.senderId, message.destinationId, (int)result.error);
+            lmp_admiral_queue_dismiss(queue, message.destinationId, record[12]);
+            if (queue->wal && message.walRecord) {
+                lmp_admiral_wal_complete(queue->wal, message.walRecord);
+            }
+        } else if (lmp_admiral_queue_push(queue, &message) == -1) {
+            break;
+        }
+
+        queue->spillRead += ADMIRAL_QUEUE_SPILL_HEADER + length;
+    }
+
+    if (queue->spillRead == queue->spillWrite) {
+        queue->spillRead = 0;
+        queue->spillWrite = 0;
+        if (ftruncate(queue->spillFd, 0) == -1) {
+            LMP_LOG_WARN("admiral", "Could not truncate the spill file");
+        }
+
+        __atomic_store_n(&queue->spilling, 0, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&queue->spillMutex);
+}
+
+static void lmp_admiral_queue_wake(lmp_admiral_queue* queue) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // NOTE(laith): a full pipe means a wakeup is already pending, so a failed write loses nothing
+    if (__atomic_load_n(&queue->consumerWaiting, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&queue->consumerWaiting, 0, __ATOMIC_ACQ_REL)) {
+        u64 one = 1;
+        while (write(queue->wakeFd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    }
+}
+
+// NOTE(laith): returns 0 when the destination used up its share, replay tells that apart from
+// there being no room at all
+static s8 lmp_admiral_queue_put(lmp_admiral_queue* queue, const lmp_admiral_message* message) {
+    if (message->packet.payload_length > LMP_PACKET_PAYLOAD_MAX_SIZE || message->destinationId >= ADMIRAL_MAX_ENDPOINTS) {
+        return -1;
+    }
+
+    if (lmp_admiral_queue_admit(queue, message) == -1) {
+        return 0;
+    }
+
+    if (__atomic_load_n(&queue->spilling, __ATOMIC_ACQUIRE) || lmp_admiral_queue_push(queue, message) == -1) {
+        if (queue->spillFd == -1 || lmp_admiral_queue_spill(queue, message) == -1) {
+            lmp_admiral_queue_dismiss(queue, message->destinationId,
+                                      message->packet.payload_length > ADMIRAL_QUEUE_INLINE_PAYLOAD);
+            return -1;
+        }
+    }
+
+    lmp_admiral_queue_wake(queue);
+
+    return 1;
+}
+
+// NOTE(laith): returns -1 when the destination used up its share, or when the ring is full and
+// there is no spill file. a message is never waited on here
+s8 lmp_admiral_queue_enqueue(lmp_admiral_queue* queue, const lmp_admiral_message* message) {
+    return lmp_admiral_queue_put(queue, message) == 1 ? 1 : -1;
+}
+
+// NOTE(laith): returns NULL when the ring is empty. the slot stays taken until the message is
+// released, so hand it back as soon as it has been forwarded
+lmp_admiral_message* lmp_admiral_queue_dequeue(lmp_admiral_queue* queue) {
+    s64 index = lmp_admiral_ring_pop(&queue->ready);
+
+    if (index == -1 && __atomic_load_n(&queue->spilling, __ATOMIC_ACQUIRE)) {
+        lmp_admiral_queue_unspill(queue);
+        index = lmp_admiral_ring_pop(&queue->ready);
+    }
+
+    if (index == -1) {
+        return NULL;
+    }
+
+    return &queue->slots[index].message;
+}
+
+// NOTE(laith): flagged first and checked again after, otherwise a producer could slip a message in
+// between and never know to wake anyone. while the log replays, a message that only went into the
+// log counts too
+s8 lmp_admiral_queue_park(lmp_admiral_queue* queue) {
+    __atomic_store_n(&queue->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+
+    u64 position = __atomic_load_n(&queue->ready.popPosition, __ATOMIC_SEQ_CST);
+    u64 sequence = __atomic_load_n(&queue->ready.cells[position & queue->ready.mask].sequence, __ATOMIC_SEQ_CST);
+    lmp_admiral_wal* wal = queue->wal;
+
+    if ((s64)(sequence - (position + 1)) >= 0 || __atomic_load_n(&queue->spilling, __ATOMIC_SEQ_CST)
+        || __atomic_load_n(&queue->abortCount, __ATOMIC_SEQ_CST)
+        || (wal && __atomic_load_n(&wal->replaying, __ATOMIC_SEQ_CST)
+            && __atomic_load_n(&wal->appends, __ATOMIC_SEQ_CST) + __atomic_load_n(&wal->completions, __ATOMIC_SEQ_CST)
+                   != wal->replayIdle)) {
+        __atomic_store_n(&queue->consumerWaiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+void lmp_admiral_queue_drain(lmp_admiral_queue* queue) {
+    u8 buffer[64];
+    ssize_t n;
+
+    // NOTE(laith): an eventfd empties in one read, a pipe can hold several wakeups
+    while ((n = read(queue->waitFd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {}
+}
+
+lmp_admiral_message* lmp_admiral_queue_dequeue_wait(lmp_admiral_queue* queue, s32 timeoutMs) {
+    u64 deadline = timeoutMs < 0 ? LMP_NET_NO_DEADLINE : lmp_net_now_ms() + (u64)timeoutMs;
+
+    for (;;) {
+        lmp_admiral_message* message = lmp_admiral_queue_dequeue(queue);
+        if (message != NULL) {
+            return message;
+        }
+
+        if (lmp_admiral_queue_park(queue) == 1) {
+            continue;
+        }
+
+        int timeout = -1;
+        if (deadline != LMP_NET_NO_DEADLINE) {
+            u64 now = lmp_net_now_ms();
+            if (now >= deadline) {
+                return NULL;
+            }
+
+            timeout = (int)(deadline - now);
+        }
+
+        // NOTE(laith): with several consumers one wakeup can get all of them up, the ones that
+        // lose the race for the message just go back to sleep
+        struct pollfd fd = {queue->waitFd, POLLIN, 0};
+        if (poll(&fd, 1, timeout) > 0) {
+            lmp_admiral_queue_drain(queue);
+        }
+    }
+}
+
+void lmp_admiral_queue_release(lmp_admiral_queue* queue, lmp_admiral_message* message) {
+    lmp_admiral_queue_slot* slot = (lmp_admiral_queue_slot*)((u8*)message - offsetof(lmp_admiral_queue_slot, message));
+
+    if (slot->large) {
+        lmp_admiral_ring_push(&queue->freeLarge, slot->large - 1);
+    }
+
+    if (queue->wal && message->walRecord) {
+        lmp_admiral_wal_complete(queue->wal, message->walRecord);
+    }
+
+    lmp_admiral_queue_dismiss(queue, message->destinationId, slot->large != 0);
+    lmp_admiral_ring_push(&queue->freeSlots, (u32)(slot - queue->slots));
+}
+
+void lmp_admiral_queue_abort_stream(lmp_admiral_queue* queue, u8 senderId, u16 streamId) {
+    pthread_mutex_lock(&queue->abortMutex);
+
+    u32 count = queue->abortCount;
+    if (count < ADMIRAL_QUEUE_ABORTS) {
+        queue->aborts[count] = (lmp_admiral_stream_abort){senderId, streamId};
+        __atomic_store_n(&queue->abortCount, count + 1, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_unlock(&queue->abortMutex);
+
+    lmp_admiral_queue_wake(queue);
+}
+
+static u32 lmp_admiral_queue_take_aborts(lmp_admiral_queue* queue, lmp_admiral_stream_abort* aborts) {
+    if (__atomic_load_n(&queue->abortCount, __ATOMIC_ACQUIRE) == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&queue->abortMutex);
+
+    u32 count = queue->abortCount;
+    memcpy(aborts, queue->aborts, count * sizeof(*aborts));
+    __atomic_store_n(&queue->abortCount, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&queue->abortMutex);
+
+    return count;
+}
+
+void lmp_admiral_scheduler_init(lmp_admiral_scheduler* scheduler, lmp_admiral_queue* queue) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->queue = queue;
+}
+
+// NOTE(laith): head through tail go into the lane as one unit that is sent back to back
+static void lmp_admiral_scheduler_append(lmp_admiral_scheduler* scheduler, lmp_admiral_message* head,
+                                         lmp_admiral_message* tail, u32 fragments) {
+    u8 lane = head->packet.flags & LMP_FLAGS_PRIORITY ? ADMIRAL_LANE_PRIORITY : ADMIRAL_LANE_BULK;
+    lmp_admiral_lane_class* class = &scheduler->classes[lane];
+    lmp_admiral_lane* destination = &class->lanes[head->destinationId];
+
+    head->fragments = fragments;
+    tail->next = NULL;
+    if (destination->tail) {
+        destination->tail->next = head;
+    } else {
+        destination->head = head;
+    }
+
+    destination->tail = tail;
+    class->pending += fragments;
+}
+
+static void lmp_admiral_scheduler_drop(lmp_admiral_scheduler* scheduler, lmp_admiral_held_stream* held, const char* reason) {
+    LMP_LOG_WARN("admiral", "Dropping stream [%u] from [%s] after %u of %u bytes: %s", held->streamId,
+                 lmp_admiral_map_id_to_endpoint(held->senderId)->name, held->received, held->total, reason);
+
+    lmp_admiral_message* message = held->head;
+    while (message) {
+        lmp_admiral_message* next = message->next;
+        lmp_admiral_queue_release(scheduler->queue, message);
+        message = next;
+    }
+
+    held->used = 0;
+}
+
+static lmp_admiral_held_stream* lmp_admiral_scheduler_held(lmp_admiral_scheduler* scheduler, u8 senderId, u16 streamId) {
+    for (u32 i = 0; i < ADMIRAL_HELD_STREAMS; i++) {
+        lmp_admiral_held_stream* held = &scheduler->held[i];
+        if (held->used && held->senderId == senderId && held->streamId == streamId) {
+            return held;
+        }
+    }
+
+    return NULL;
+}
+
+// NOTE(laith): a fragment that does not pick up where its stream left off means the stream is
+// broken, what was held of it goes and so does the fragment. fragments of a stream that was
+// already dropped find nothing to join and are let go of quietly
+void lmp_admiral_scheduler_push(lmp_admiral_scheduler* scheduler, lmp_admiral_message* message, u64 now) {
+    lmp_fragment fragment;
+    s8 last = lmp_admiral_read_fragment(&message->packet, &fragment);
+
+    if (last == -1 || (last == 1 && fragment.offset == 0)) {
+        lmp_admiral_scheduler_append(scheduler, message, message, 1);
+        return;
+    }
+
+    lmp_admiral_held_stream* held = lmp_admiral_scheduler_held(scheduler, message->senderId, fragment.stream_id);
+
+    if (fragment.offset == 0) {
+        if (held) {
+            lmp_admiral_scheduler_drop(scheduler, held, "started over");
+        }
+
+        for (u32 i = 0; i < ADMIRAL_HELD_STREAMS && held == NULL; i++) {
+            held = scheduler->held[i].used ? NULL : &scheduler->held[i];
+        }
+
+        if (held == NULL) {
+            LMP_LOG_ERROR("admiral", "Holding %d streams already, dropping stream [%u] from [%s]", ADMIRAL_HELD_STREAMS,
+                          fragment.stream_id, lmp_admiral_map_id_to_endpoint(message->senderId)->name);
+            lmp_admiral_queue_release(scheduler->queue, message);
+            return;
+        }
+
+        message->next = NULL;
+        *held = (lmp_admiral_held_stream){message, message, now, 1, (u32)fragment.data_length, fragment.total,
+                                          fragment.stream_id, message->senderId, 1};
+        return;
+    }
+
+    if (held == NULL || fragment.offset != held->received || fragment.total != held->total
+        || held->head->destinationId != message->destinationId) {
+        if (held) {
+            lmp_admiral_scheduler_drop(scheduler, held, "fragment out of order");
+        }
+
+        lmp_admiral_queue_release(scheduler->queue, message);
+        return;
+    }
+
+    message->next = NULL;
+    held->tail->next = message;
+    held->tail = message;
+    held->fragments++;
+    held->received += (u32)fragment.data_length;
+    held->lastActivity = now;
+
+    if (last == 1) {
+        lmp_admiral_scheduler_append(scheduler, held->head, held->tail, held->fragments);
+        held->used = 0;
+    }
+}
+
+// NOTE(laith): the aborts are taken before the queue is drained. a network thread only aborts a
+// stream after queueing what it had of it, so by the time they are applied every fragment that
+// made it into the ring is held here and goes with the stream
+s8 lmp_admiral_scheduler_fill(lmp_admiral_scheduler* scheduler, u64 now) {
+    lmp_admiral_stream_abort aborts[ADMIRAL_QUEUE_ABORTS];
+    u32 count = lmp_admiral_queue_take_aborts(scheduler->queue, aborts);
+
+    s8 more = 0;
+    if (scheduler->queue->wal) {
+        more = lmp_admiral_wal_replay(scheduler->queue->wal, scheduler->queue);
+    }
+
+    lmp_admiral_message* queued;
+    while ((queued = lmp_admiral_queue_dequeue(scheduler->queue))) {
+        lmp_admiral_scheduler_push(scheduler, queued, now);
+    }
+
+    for (u32 i = 0; i < count; i++) {
+        lmp_admiral_held_stream* held = lmp_admiral_scheduler_held(scheduler, aborts[i].senderId, aborts[i].streamId);
+        if (held) {
+            lmp_admiral_scheduler_drop(scheduler, held, "the sender was cut off");
+        }
+    }
+
+    for (u32 i = 0; i < ADMIRAL_HELD_STREAMS; i++) {
+        lmp_admiral_held_stream* held = &scheduler->held[i];
+        if (held->used && now - held->lastActivity > LMP_STREAM_IDLE_TIMEOUT_MS) {
+            lmp_admiral_scheduler_drop(scheduler, held, "timed out");
+        }
+    }
+
+    return more;
+}
+
+// NOTE(laith): a lane gets its quantum once when its turn starts and keeps going while its head
+// still fits in the deficit. an empty lane forfeits what it had left, so an idle destination
+// can't save up a burst, and so does one sitting out a retry. every lane with a head that is
+// allowed to send fits within two rounds, so that is as far as this looks
+static lmp_admiral_message* lmp_admiral_scheduler_pick(const lmp_admiral_scheduler* scheduler,
+                                                       lmp_admiral_lane_class* class, u64 now) {
+    if (class->pending == 0) {
+        return NULL;
+    }
+
+    for (u32 turns = 0; turns <= 2 * ADMIRAL_MAX_ENDPOINTS; turns++) {
+        lmp_admiral_lane* lane = &class->lanes[class->current];
+
+        if (lane->head && scheduler->retryAt[class->current] <= now) {
+            if (!class->turnStarted) {
+                const lmp_admiral_registry_entry* entry = lmp_admiral_map_id_to_endpoint(class->current);
+                lane->deficit += (u64)ADMIRAL_LANE_QUANTUM * (entry ? entry->weight : 1);
+                class->turnStarted = 1;
+            }
+
+            if (lane->head->packet.payload_length <= lane->deficit) {
+                return lane->head;
+            }
+        } else {
+            lane->deficit = 0;
+        }
+
+        class->turnStarted = 0;
+        class->current = (class->current + 1) % ADMIRAL_MAX_ENDPOINTS;
+    }
+
+    return NULL;
+}
+
+lmp_admiral_message* lmp_admiral_scheduler_next(lmp_admiral_scheduler* scheduler, u64 now) {
+    for (u8 lane = 0; lane < ADMIRAL_LANE_CLASSES; lane++) {
+        lmp_admiral_message* message = lmp_admiral_scheduler_pick(scheduler, &scheduler->classes[lane], now);
+        if (message) {
+            scheduler->picked = &scheduler->classes[lane];
+            return message;
+        }
+    }
+
+    return NULL;
+}
+
+// NOTE(laith): takes the message and the rest of its unit off the lane, they are the caller's to
+// release. a whole stream is charged to the deficit even if that runs it past zero, it can only go
+// out in one piece
+void lmp_admiral_scheduler_done(lmp_admiral_scheduler* scheduler, lmp_admiral_message* message) {
+    lmp_admiral_lane_class* class = scheduler->picked;
+    lmp_admiral_lane* lane = &class->lanes[message->destinationId];
+
+    lmp_admiral_message* last = message;
+    u64 bytes = last->packet.payload_length;
+    for (u32 i = 1; i < message->fragments; i++) {
+        last = last->next;
+        bytes += last->packet.payload_length;
+    }
+
+    lane->deficit -= MIN(bytes, lane->deficit);
+    lane->head = last->next;
+    if (lane->head == NULL) {
+        lane->tail = NULL;
+        lane->deficit = 0;
+    }
+
+    class->pending -= message->fragments;
+    scheduler->backoff[message->destinationId] = 0;
+}
+
+// NOTE(laith): ends the destination's turn, it gets a new one once the wait is over
+void lmp_admiral_scheduler_defer(lmp_admiral_scheduler* scheduler, u8 destination, u64 now) {
+    u32 backoff = scheduler->backoff[destination];
+    backoff = backoff == 0 ? ADMIRAL_RETRY_MIN_MS : MIN(backoff * 2, ADMIRAL_RETRY_MAX_MS);
+
+    scheduler->backoff[destination] = backoff;
+    scheduler->retryAt[destination] = now + backoff;
+
+    lmp_admiral_lane_class* class = scheduler->picked;
+    class->lanes[destination].deficit = 0;
+    class->turnStarted = 0;
+    class->current = (class->current + 1) % ADMIRAL_MAX_ENDPOINTS;
+}
+
+s32 lmp_admiral_scheduler_timeout(const lmp_admiral_scheduler* scheduler, u64 now) {
+    s32 timeout = -1;
+
+    for (u32 i = 0; i < ADMIRAL_MAX_ENDPOINTS; i++) {
+        u8 waiting = 0;
+        for (u8 lane = 0; lane < ADMIRAL_LANE_CLASSES; lane++) {
+            waiting |= scheduler->classes[lane].lanes[i].head != NULL;
+        }
+
+        if (!waiting) {
+            continue;
+        }
+
+        if (scheduler->retryAt[i] <= now) {
+            return 0;
+        }
+
+        s32 wait = (s32)(scheduler->retryAt[i] - now);
+        if (timeout == -1 || wait < timeout) {
+            timeout = wait;
+        }
+    }
+
+    for (u32 i = 0; i < ADMIRAL_HELD_STREAMS; i++) {
+        const lmp_admiral_held_stream* held = &scheduler->held[i];
+        if (!held->used) {
+            continue;
+        }
+
+        u64 expires = held->lastActivity + LMP_STREAM_IDLE_TIMEOUT_MS + 1;
+        s32 wait = expires > now ? (s32)(expires - now) : 0;
+        if (timeout == -1 || wait < timeout) {
+            timeout = wait;
+        }
+    }
+
+    return timeout;
+}
+
+u64 lmp_admiral_scheduler_pending(const lmp_admiral_scheduler* scheduler) {
+    u64 pending = 0;
+    for (u8 lane = 0; lane < ADMIRAL_LANE_CLASSES; lane++) {
+        pending += scheduler->classes[lane].pending;
+    }
+
+    return pending;
+}
+
+static u32 lmp_admiral_wal_checksum(u8 destinationId, u8 senderId, const u8* packet, u32 length) {
+    u32 hash = 2166136261u;
+    hash = (hash ^ destinationId) * 16777619u;
+    hash = (hash ^ senderId) * 16777619u;
+
+    for (u32 i = 0; i < length; i++) {
+        hash = (hash ^ packet[i]) * 16777619u;
+    }
+
+    return hash ^ length;
+}
+
+static u32 lmp_admiral_wal_record_size(u32 length) {
+    return (u32)arena_align_forward(sizeof(lmp_admiral_wal_record) + length, 8);
+}
+
+static void lmp_admiral_wal_path(const lmp_admiral_wal* wal, u32 id, char* path, size_t size) {
+    snprintf(path, size, "%s/%08x.wal", wal->directory, id);
+}
+
+// NOTE(laith): the whole segment is allocated up front, a write into a mapping past what the disk
+// could hold would be a SIGBUS instead of an error
+static lmp_admiral_wal_segment* lmp_admiral_wal_map(lmp_admiral_wal* wal, u32 id, u8 create) {
+    lmp_admiral_wal_segment* segment = &wal->segments[id & (ADMIRAL_WAL_MAX_SEGMENTS - 1)];
+    if (segment->id != 0) {
+        return NULL;
+    }
+
+    char path[ADMIRAL_WAL_PATH_SIZE + 16];
+    lmp_admiral_wal_path(wal, id, path, sizeof(path));
+
+    s32 fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0600);
+    if (fd == -1) {
+        return NULL;
+    }
+
+#if OS_LINUX
+    s8 allocated = !create || posix_fallocate(fd, 0, ADMIRAL_WAL_SEGMENT_SIZE) == 0;
+#else
+    s8 allocated = !create || ftruncate(fd, ADMIRAL_WAL_SEGMENT_SIZE) == 0;
+#endif
+
+    struct stat st;
+    if (!allocated || fstat(fd, &st) == -1 || st.st_size != ADMIRAL_WAL_SEGMENT_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, ADMIRAL_WAL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    // NOTE(laith): a new file only survives a crash once its directory entry does
+    if (create) {
+        s32 directory = open(wal->directory, O_RDONLY | O_CLOEXEC);
+        if (directory != -1) {
+            fsync(directory);
+            close(directory);
+        }
+    }
+
+    memset(segment, 0, sizeof(*segment));
+    segment->map = map;
+    __atomic_store_n(&segment->id, id, __ATOMIC_RELEASE);
+
+    return segment;
+}
+
+static void lmp_admiral_wal_wake(lmp_admiral_wal* wal) {
+    if (!__atomic_load_n(&wal->dirty, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&wal->mutex);
+        wal->dirty = 1;
+        pthread_cond_signal(&wal->commit);
+        pthread_mutex_unlock(&wal->mutex);
+    }
+}
+
+// NOTE(laith): the only thread that unmaps segments, so nothing it msyncs can go away under it
+static void* lmp_admiral_wal_flusher(void* args) {
+    lmp_admiral_wal* wal = args;
+    struct timespec interval = {0, ADMIRAL_WAL_COMMIT_INTERVAL_MS * 1000000L};
+
+    for (;;) {
+        pthread_mutex_lock(&wal->mutex);
+        while (!wal->dirty) {
+            pthread_cond_wait(&wal->commit, &wal->mutex);
+        }
+        pthread_mutex_unlock(&wal->mutex);
+
+        // NOTE(laith): everything written while this sleeps rides along with the same msync
+        nanosleep(&interval, NULL);
+        __atomic_store_n(&wal->dirty, 0, __ATOMIC_RELEASE);
+
+        for (u32 i = 0; i < ADMIRAL_WAL_MAX_SEGMENTS; i++) {
+            lmp_admiral_wal_segment* segment = &wal->segments[i];
+            if (__atomic_load_n(&segment->id, __ATOMIC_ACQUIRE) != 0
+                && __atomic_exchange_n(&segment->dirty, 0, __ATOMIC_ACQ_REL)
+                && msync(segment->map, ADMIRAL_WAL_SEGMENT_SIZE, MS_SYNC) == -1) {
+                LMP_LOG_ERROR("admiral", "Could not commit write-ahead log segment %08x", segment->id);
+            }
+        }
+
+        pthread_mutex_lock(&wal->mutex);
+
+        for (u32 i = 0; i < ADMIRAL_WAL_MAX_SEGMENTS; i++) {
+            lmp_admiral_wal_segment* segment = &wal->segments[i];
+            if (segment->id == 0 || !__atomic_load_n(&segment->sealed, __ATOMIC_ACQUIRE)
+                || __atomic_load_n(&segment->completed, __ATOMIC_ACQUIRE) != segment->appended
+                || (__atomic_load_n(&wal->replaying, __ATOMIC_ACQUIRE)
+                    && segment->id >= __atomic_load_n(&wal->cursorSegment, __ATOMIC_ACQUIRE))) {
+                continue;
+            }
+
+            char path[ADMIRAL_WAL_PATH_SIZE + 16];
+            lmp_admiral_wal_path(wal, segment->id, path, sizeof(path));
+
+            munmap(segment->map, ADMIRAL_WAL_SEGMENT_SIZE);
+            unlink(path);
+            __atomic_store_n(&segment->id, 0, __ATOMIC_RELEASE);
+        }
+
+        pthread_mutex_unlock(&wal->mutex);
+    }
+
+    return NULL;
+}
+
+// NOTE(laith): walks one segment from the start to find where its records end, counting what is
+// delivered already and clearing queued, which a previous run may have left set
+static u64 lmp_admiral_wal_scan_segment(lmp_admiral_wal_segment* segment) {
+    u64 waiting = 0;
+
+    while (segment->used + sizeof(lmp_admiral_wal_record) <= ADMIRAL_WAL_SEGMENT_SIZE) {
+        lmp_admiral_wal_record* record = (lmp_admiral_wal_record*)(segment->map + segment->used);
+        u32 size = lmp_admiral_wal_record_size(record->length);
+
+        if (record->length == 0 || record->length > LMP_PACKET_MAX_SIZE || segment->used + size > ADMIRAL_WAL_SEGMENT_SIZE
+            || record->checksum != lmp_admiral_wal_checksum(record->destinationId, record->senderId,
+                                                            (const u8*)(record + 1), record->length)) {
+            break;
+        }
+
+        segment->used += size;
+        segment->appended++;
+        record->queued = 0;
+
+        if (record->delivered) {
+            segment->completed++;
+        } else {
+            waiting++;
+        }
+    }
+
+    segment->sealed = 1;
+    segment->dirty = 1;
+
+    return waiting;
+}
+
+// NOTE(laith): moves id and offset on to the next record there is, up to used in segment last.
+// returns NULL at the end
+static lmp_admiral_wal_record* lmp_admiral_wal_next(lmp_admiral_wal* wal, u32* id, u32* offset, u32 last, u32 used) {
+    for (;;) {
+        lmp_admiral_wal_segment* segment = &wal->segments[*id & (ADMIRAL_WAL_MAX_SEGMENTS - 1)];
+        if (__atomic_load_n(&segment->id, __ATOMIC_ACQUIRE) == *id && *offset < (*id == last ? used : segment->used)) {
+            return (lmp_admiral_wal_record*)(segment->map + *offset);
+        }
+
+        if (*id >= last) {
+            return NULL;
+        }
+
+        (*id)++;
+        *offset = 0;
+    }
+}
+
+s8 lmp_admiral_wal_replay(lmp_admiral_wal* wal, lmp_admiral_queue* queue) {
+    if (!__atomic_load_n(&wal->replaying, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    u64 activity = __atomic_load_n(&wal->appends, __ATOMIC_ACQUIRE) + __atomic_load_n(&wal->completions, __ATOMIC_ACQUIRE);
+    if (activity == wal->replayIdle) {
+        return 0;
+    }
+
+    // NOTE(laith): everything below where the head is now was written out under the lock already
+    pthread_mutex_lock(&wal->mutex);
+    u32 last = wal->current ? wal->current->id : wal->nextId - 1;
+    u32 used = wal->segments[last & (ADMIRAL_WAL_MAX_SEGMENTS - 1)].used;
+    pthread_mutex_unlock(&wal->mutex);
+
+    u32 replayed = 0;
+    s8 stalled = 0;
+    s8 more = 0;
+
+    for (u32 budget = ADMIRAL_WAL_REPLAY_BATCH; ; budget--) {
+        if (budget == 0) {
+            more = 1;
+            break;
+        }
+
+        lmp_admiral_wal_record* record = lmp_admiral_wal_next(wal, &wal->scanSegment, &wal->scanOffset, last, used);
+        if (record == NULL) {
+            break;
+        }
+
+        u64 reference = (u64)wal->scanSegment << 32 | wal->scanOffset;
+        wal->scanOffset += lmp_admiral_wal_record_size(record->length);
+
+        if (record->delivered || record->queued
+            || (record->destinationId < ADMIRAL_MAX_ENDPOINTS && wal->blocked[record->destinationId])) {
+            continue;
+        }
+
+        lmp_result result;
+        lmp_admiral_message message = {record->destinationId, record->senderId, {0}, NULL, reference, 0};
+        lmp_packet_deserialize((const u8*)(record + 1), record->length, &message.packet, &result);
+
+        if (result.error != LMP_ERR_NONE || record->destinationId >= ADMIRAL_MAX_ENDPOINTS) {
+            lmp_admiral_wal_complete(wal, reference);
+            continue;
+        }
+
+        s8 e = lmp_admiral_queue_put(queue, &message);
+        if (e == 1) {
+            record->queued = 1;
+            replayed++;
+        } else if (e == 0) {
+            wal->blocked[record->destinationId] = 1;
+        } else {
+            // NOTE(laith): picked up again from the same record once something is released
+            wal->scanOffset = (u32)reference;
+            stalled = 1;
+            break;
+        }
+    }
+
+    u32 cursorSegment = wal->cursorSegment;
+    lmp_admiral_wal_record* record;
+    while ((record = lmp_admiral_wal_next(wal, &cursorSegment, &wal->cursorOffset, last, used))
+           && (record->delivered || record->queued)) {
+        wal->cursorOffset += lmp_admiral_wal_record_size(record->length);
+    }
+
+    // NOTE(laith): the flusher keeps every segment from the cursor on, that is what replay reads
+    __atomic_store_n(&wal->cursorSegment, cursorSegment, __ATOMIC_RELEASE);
+
+    if (!more && !stalled) {
+        if (record == NULL) {
+            memset(wal->blocked, 0, sizeof(wal->blocked));
+
+            pthread_mutex_lock(&wal->mutex);
+            u32 head = wal->current ? wal->current->id : wal->nextId - 1;
+            if (head == last && wal->segments[last & (ADMIRAL_WAL_MAX_SEGMENTS - 1)].used == used) {
+                __atomic_store_n(&wal->replaying, 0, __ATOMIC_RELEASE);
+            }
+            pthread_mutex_unlock(&wal->mutex);
+
+            if (!__atomic_load_n(&wal->replaying, __ATOMIC_ACQUIRE)) {
+                LMP_LOG_INFO("admiral", "Caught up with the write-ahead log");
+                return 0;
+            }
+
+            return 1;
+        }
+
+        // NOTE(laith): the sweep got to the end, the next one starts over from the oldest record
+        // still waiting and gives every destination another go
+        wal->scanSegment = wal->cursorSegment;
+        wal->scanOffset = wal->cursorOffset;
+        memset(wal->blocked, 0, sizeof(wal->blocked));
+    }
+
+    if (replayed > 0) {
+        wal->replayIdle = UINT64_MAX;
+        return 1;
+    }
+
+    if (!more) {
+        wal->replayIdle = activity;
+    }
+
+    return more;
+}
+
+s64 lmp_admiral_wal_open(lmp_admiral_wal* wal, const char* directory, lmp_admiral_queue* queue) {
+    memset(wal, 0, sizeof(*wal));
+    snprintf(wal->directory, sizeof(wal->directory), "%s", directory);
+    pthread_mutex_init(&wal->mutex, NULL);
+    pthread_cond_init(&wal->commit, NULL);
+    wal->replayIdle = UINT64_MAX;
+
+    if (mkdir(directory, 0700) == -1 && errno != EEXIST) {
+        return -1;
+    }
+
+    DIR* d = opendir(directory);
+    if (d == NULL) {
+        return -1;
+    }
+
+    // NOTE(laith): segment ids only ever grow, so going through them in order replays messages in
+    // the order admiral accepted them
+    u32 ids[ADMIRAL_WAL_MAX_SEGMENTS];
+    u32 count = 0;
+    struct dirent* entry;
+
+    while ((entry = readdir(d)) != NULL) {
+        u32 id;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%8x.%7s", &id, suffix) != 2 || strcmp(suffix, "wal") != 0 || id == 0) {
+            continue;
+        }
+
+        if (count == ARR_LENGTH(ids)) {
+            closedir(d);
+            return -1;
+        }
+
+        u32 at = count++;
+        while (at > 0 && ids[at - 1] > id) {
+            ids[at] = ids[at - 1];
+            at--;
+        }
+        ids[at] = id;
+    }
+
+    closedir(d);
+
+    queue->wal = wal;
+    wal->nextId = 1;
+
+    u64 waiting = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        lmp_admiral_wal_segment* segment = lmp_admiral_wal_map(wal, ids[i], 0);
+        if (segment == NULL) {
+            LMP_LOG_ERROR("admiral", "Could not open write-ahead log segment %08x", ids[i]);
+            return -1;
+        }
+
+        u64 found = lmp_admiral_wal_scan_segment(segment);
+        if (found > 0 && waiting == 0) {
+            wal->cursorSegment = ids[i];
+        }
+
+        waiting += found;
+        wal->nextId = ids[i] + 1;
+    }
+
+    if (waiting > 0) {
+        wal->scanSegment = wal->cursorSegment;
+        wal->replaying = 1;
+    }
+
+    // NOTE(laith): the first pass drops the segments that turned out to be done
+    wal->dirty = 1;
+
+    pthread_t flusher;
+    if (pthread_create(&flusher, NULL, lmp_admiral_wal_flusher, wal) != 0) {
+        return -1;
+    }
+
+    pthread_detach(flusher);
+
+    return (s64)waiting;
+}
+
+s8 lmp_admiral_wal_append(lmp_admiral_wal* wal, lmp_admiral_message* message) {
+    u8 packet[LMP_PACKET_MAX_SIZE];
+    lmp_result result;
+
+    lmp_packet_serialize(packet, sizeof(packet), &message->packet, &result);
+    if (result.error != LMP_ERR_NONE) {
+        return -1;
+    }
+
+    // NOTE(laith): only finding room and the copy happen under the lock
+    u32 size = lmp_admiral_wal_record_size((u32)result.size);
+    u32 checksum = lmp_admiral_wal_checksum(message->destinationId, message->senderId, packet, (u32)result.size);
+
+    pthread_mutex_lock(&wal->mutex);
+
+    lmp_admiral_wal_segment* segment = wal->current;
+    if (segment == NULL || segment->used + size > ADMIRAL_WAL_SEGMENT_SIZE) {
+        if (segment) {
+            __atomic_store_n(&segment->sealed, 1, __ATOMIC_RELEASE);
+        }
+
+        segment = lmp_admiral_wal_map(wal, wal->nextId, 1);
+        wal->current = segment;
+
+        if (segment == NULL) {
+            pthread_mutex_unlock(&wal->mutex);
+            return -1;
+        }
+
+        wal->nextId++;
+    }
+
+    lmp_admiral_wal_record* record = (lmp_admiral_wal_record*)(segment->map + segment->used);
+    memcpy(record + 1, packet, result.size);
+    record->destinationId = message->destinationId;
+    record->senderId = message->senderId;
+    record->delivered = 0;
+    record->queued = 0;
+    record->length = (u32)result.size;
+    record->checksum = checksum;
+
+    message->walRecord = (u64)segment->id << 32 | segment->used;
+    segment->used += size;
+    __atomic_add_fetch(&segment->appended, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&segment->dirty, 1, __ATOMIC_RELEASE);
+
+    // NOTE(laith): replaying only ever stops under the lock, so a message either goes in behind
+    // everything replay still has to get to or replay already got past the end of the log
+    s8 e = 1;
+    if (wal->replaying) {
+        __atomic_add_fetch(&wal->appends, 1, __ATOMIC_SEQ_CST);
+        e = 0;
+    }
+
+    if (!wal->dirty) {
+        wal->dirty = 1;
+        pthread_cond_signal(&wal->commit);
+    }
+
+    pthread_mutex_unlock(&wal->mutex);
+
+    return e;
+}
+
+// NOTE(laith): the mark is committed with the next flush. a crash before that only means the
+// message gets delivered twice, never that it gets lost
+void lmp_admiral_wal_complete(lmp_admiral_wal* wal, u64 reference) {
+    lmp_admiral_wal_segment* segment = &wal->segments[(reference >> 32) & (ADMIRAL_WAL_MAX_SEGMENTS - 1)];
+    lmp_admiral_wal_record* record = (lmp_admiral_wal_record*)(segment->map + (u32)reference);
+
+    record->delivered = 1;
+    __atomic_store_n(&segment->dirty, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&segment->completed, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&wal->completions, 1, __ATOMIC_SEQ_CST);
+
+    lmp_admiral_wal_wake(wal);
+}
+
+// NOTE(laith): this function changes how ownership of the packet is handled. This paacket lives
+// in the network loop arena and now it is getting copied over to the queue arena. with that, after
+// this function ends, we can safely pop the packet memory of the network arena and start again
+//
+// Do NOT share memory across threads!
+s8 lmp_admiral_add_packet_to_queue(lmp_admiral_queue* queue, lmp_packet* packet, const lmp_admiral_registry_entry* endpoint) {
+    // NOTE(laith): this should be [dest][sender][EMPTY PAYLOAD BYTE] at the minimum
+    if (packet->payload_length < 3) {
+        return -1;
+    }
+
+    // NOTE(laith): this converts and ascii string to its byte form
+    u8 destination = packet->payload[0] - '0';
+    u8 sender = packet->payload[1] - '0';
+
+    if (lmp_admiral_map_id_to_endpoint(destination) == NULL || lmp_admiral_map_id_to_endpoint(sender) == NULL) {
+        return -1;
+    }
+
+    if (sender != endpoint->id) {
+        LMP_LOG_ERROR("admiral", "[%s] is claiming to be a [%s]", endpoint->name, lmp_admiral_map_id_to_endpoint(sender)->name);
+        return -1;
+    }
+
+    // NOTE(laith): admiral holds a whole stream before it forwards any of it, so one that can't fit
+    // in its destination's share of the queue is turned away at its first fragment
+    lmp_fragment fragment;
+    if (lmp_admiral_read_fragment(packet, &fragment) == 0 && fragment.offset == 0 && fragment.data_length > 0) {
+        u32 share = packet->payload_length > ADMIRAL_QUEUE_INLINE_PAYLOAD ? queue->shareLarge : queue->shareSlots;
+        if ((u64)fragment.total > (u64)share * fragment.data_length) {
+            LMP_LOG_ERROR("admiral", "Stream [%u] of %u bytes from [%s] is bigger than the queue can hold",
+                          fragment.stream_id, fragment.total, endpoint->name);
+            return -1;
+        }
+    }
+
+    lmp_admiral_message message = {destination, sender, *packet, NULL, 0, 0};
+    s8 logged = queue->wal ? lmp_admiral_wal_append(queue->wal, &message) : 1;
+    if (logged == -1) {
+        LMP_LOG_ERROR("admiral", "Could not log message from [%s]", endpoint->name);
+        return -1;
+    }
+
+    // NOTE(laith): while the log replays the message waits in it behind the older ones
+    s8 e = 1;
+    if (logged == 0) {
+        lmp_admiral_queue_wake(queue);
+    } else {
+        e = lmp_admiral_queue_enqueue(queue, &message);
+    }
+
+    if (e == -1) {
+        // NOTE(laith): the sender is told it was rejected, so it must not come back on a restart
+        if (message.walRecord) {
+            lmp_admiral_wal_complete(queue->wal, message.walRecord);
+        }
+
+        LMP_LOG_ERROR("admiral", "Could not enqueue message from [%s]", endpoint->name);
+        return -1;
+    }
+
+    // NOTE(laith): streams are logged once by the network loop, not per fragment
+    if (packet->arg == LMP_ARG_SEND_FRAGMENT) {
+        return 1;
+    }
+
+    LMP_LOG_INFO("admiral", "Recieved and added message from [%s] to queue", endpoint->name);
+
+    return 1;
+}
+
+// NOTE(laith): probably want some further checks here but given the checks within the enqueue call
+// and the protocol itself, it should be fine?
+//
+// The routing bytes are dropped by moving the packet view past them, the payload itself is left
+// where the queue put it so forwarding can send it straight from there
+void lmp_admiral_sanitize_message(lmp_admiral_message* message) {
+    lmp_result result;
+    lmp_packet_strip(&message->packet, 2, &result);
+}
+
+s32 lmp_admiral_connect_to_endpoint(u8 id) {
+    const lmp_admiral_registry_entry* entry = lmp_admiral_map_id_to_endpoint(id);
+    if (entry == NULL || id == ADMIRAL) {
+        return -1;
+    }
+
+    lmp_result result;
+    s32 socketFd = lmp_net_connect_unix(entry->socket, &result);
+    if (socketFd != -1) {
+        return socketFd;
+    }
+
+    socketFd = lmp_net_connect(entry->host, entry->port, 0, LMP_NET_CONNECT_TIMEOUT_MS, &result);
+    if (socketFd == -1) {
+        return -1;
+    }
+
+    lmp_net_set_nodelay(socketFd, 1);
+
+    return socketFd;
+}
+
+// NOTE(laith): the message must already be sanitized. the header is rebuilt on the stack and the
+// payload goes out of the queue memory it is sitting in through writev
+s8 lmp_admiral_forward_message(u32 fd, const lmp_admiral_message* message) {
+    lmp_result result;
+    lmp_error error = lmp_net_send_packet_iov(fd, &message->packet, &result);
+
+    return error == LMP_ERR_NONE ? 1 : -1;
+}
+
+// NOTE(laith): reads the fragment header that sits behind the routing bytes. returns 1 if this is
+// the last fragment of its stream, 0 if more are coming and -1 if it is not a valid fragment
+s8 lmp_admiral_read_fragment(const lmp_packet* packet, lmp_fragment* fragment) {
+    if (packet->arg != LMP_ARG_SEND_FRAGMENT || packet->payload_length < 2) {
+        return -1;
+    }
+
+    lmp_result result;
+    lmp_fragment_deserialize(packet->payload + 2, packet->payload_length - 2, fragment, &result);
+    if (result.error != LMP_ERR_NONE) {
+        return -1;
+    }
+
+    return fragment->offset + fragment->data_length == fragment->total;
+}
+
+static const u8 lmp_admiral_empty_payload[] = {LMP_PAYLOAD_EMPTY};
+
+// NOTE(laith): the version is left alone so the caller can answer in the version it was spoken to in
+void lmp_admiral_invalidate_packet(lmp_packet* packet) {
+    packet->type = LMP_TYPE_INVALID;
+    packet->arg = LMP_ARG_INVALID_PAYLOAD;
+    packet->flags = LMP_FLAGS_NONE;
+    packet->payload = lmp_admiral_empty_payload;
+    packet->payload_length = 1;
+}
+
+static char* endpoint[] = {
+    "admiral",
+    "hotel",
+    "scheduler"
+};
+
+// NOTE(laith): filled once by lmp_admiral_registry_load before any network thread starts and only
+// read after that, so lookups take no lock. slots is an open addressed table over the binary
+// address of each endpoint holding its id + 1, 0 is an empty slot
+static struct {
+    lmp_admiral_registry_entry endpoints[ADMIRAL_MAX_ENDPOINTS];
+    u8 slots[ADMIRAL_REGISTRY_SLOTS];
+} registry;
+
+static s8 lmp_admiral_key_from_address(const struct sockaddr* address, socklen_t length, lmp_admiral_endpoint_key* key) {
+    memset(key, 0, sizeof(*key));
+
+    if (address->sa_family == AF_INET && length >= sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)address;
+        key->address[10] = 0xff;
+        key->address[11] = 0xff;
+        memcpy(key->address + 12, &in->sin_addr, 4);
+        key->port = ntohs(in->sin_port);
+        return 1;
+    }
+
+    if (address->sa_family == AF_INET6 && length >= sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)address;
+        memcpy(key->address, &in6->sin6_addr, 16);
+        key->port = ntohs(in6->sin6_port);
+        return 1;
+    }
+
+    return -1;
+}
+
+// NOTE(laith): fnv-1a, the keys are 18 bytes so anything fancier would not pay for itself
+static u32 lmp_admiral_hash_key(const lmp_admiral_endpoint_key* key) {
+    u32 hash = 2166136261u;
+
+    for (u32 i = 0; i < sizeof(key->address); i++) {
+        hash = (hash ^ key->address[i]) * 16777619u;
+    }
+
+    hash = (hash ^ (key->port & 0xff)) * 16777619u;
+    hash = (hash ^ (key->port >> 8)) * 16777619u;
+
+    return hash;
+}
+
+static s8 lmp_admiral_registry_add(u32 id, const char* name, const char* host, u32 port, const char* socketPath,
+                                   const char* user, u32 weight) {
+    if (id >= ADMIRAL_MAX_ENDPOINTS || registry.endpoints[id].used || port == 0 || port > 0xffff
+        || weight == 0 || weight > ADMIRAL_MAX_WEIGHT) {
+        return -1;
+    }
+
+    lmp_admiral_registry_entry* entry = &registry.endpoints[id];
+    memset(entry, 0, sizeof(*entry));
+
+    struct sockaddr_in in = {0};
+    struct sockaddr_in6 in6 = {0};
+
+    if (inet_pton(AF_INET, host, &in.sin_addr) == 1) {
+        in.sin_family = AF_INET;
+        in.sin_port = htons(port);
+        lmp_admiral_key_from_address((struct sockaddr*)&in, sizeof(in), &entry->key);
+    } else if (inet_pton(AF_INET6, host, &in6.sin6_addr) == 1) {
+        in6.sin6_family = AF_INET6;
+        in6.sin6_port = htons(port);
+        lmp_admiral_key_from_address((struct sockaddr*)&in6, sizeof(in6), &entry->key);
+    } else {
+        return -1;
+    }
+
+    u32 slot = lmp_admiral_hash_key(&entry->key) & (ADMIRAL_REGISTRY_SLOTS - 1);
+    while (registry.slots[slot] != 0) {
+        if (memcmp(&registry.endpoints[registry.slots[slot] - 1].key, &entry->key, sizeof(entry->key)) == 0) {
+            return -1;
+        }
+
+        slot = (slot + 1) & (ADMIRAL_REGISTRY_SLOTS - 1);
+    }
+
+    entry->id = id;
+    entry->port = port;
+    entry->weight = weight;
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    snprintf(entry->host, sizeof(entry->host), "%s", host);
+    snprintf(entry->user, sizeof(entry->user), "%s", user ? user : name);
+
+    if (socketPath) {
+        snprintf(entry->socket, sizeof(entry->socket), "%s", socketPath);
+    } else {
+        snprintf(entry->socket, sizeof(entry->socket), ADMIRAL_SOCKET_DIRECTORY "/%s.sock", name);
+    }
+
+    // NOTE(laith): a service whose user does not exist on this host keeps -1 and can only reach
+    // admiral over tcp
+    struct passwd passwdEntry;
+    struct passwd* found = NULL;
+    char buffer[1024];
+
+    entry->uid = -1;
+    if (getpwnam_r(entry->user, &passwdEntry, buffer, sizeof(buffer), &found) == 0 && found) {
+        entry->uid = found->pw_uid;
+    }
+
+    entry->used = 1;
+    registry.slots[slot] = id + 1;
+
+    return 1;
+}
+
+// NOTE(laith): returns 1 when the endpoints came from path, 0 when there is no file there and the
+// built in endpoints are used instead, and -1 when the file has a bad line in it
+s8 lmp_admiral_registry_load(const char* path) {
+    memset(&registry, 0, sizeof(registry));
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno != ENOENT) {
+            return -1;
+        }
+
+        lmp_admiral_registry_add(ADMIRAL, endpoint[ADMIRAL], ADMIRAL_HOST_ADMIRAL, ADMIRAL_PORT_ADMIRAL,
+                                 ADMIRAL_SOCKET_ADMIRAL, ADMIRAL_USER_ADMIRAL, 1);
+        lmp_admiral_registry_add(HOTEL, endpoint[HOTEL], ADMIRAL_HOST_HOTEL, ADMIRAL_PORT_HOTEL,
+                                 ADMIRAL_SOCKET_HOTEL, ADMIRAL_USER_HOTEL, 1);
+        lmp_admiral_registry_add(SCHEDULER, endpoint[SCHEDULER], ADMIRAL_HOST_SCHEDULER, ADMIRAL_PORT_SCHEDULER,
+                                 ADMIRAL_SOCKET_SCHEDULER, ADMIRAL_USER_SCHEDULER, 1);
+        return 0;
+    }
+
+    char line[512];
+    u32 lineNumber = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineNumber++;
+
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        u32 id, port, weight = 1;
+        char name[ADMIRAL_ENDPOINT_NAME_SIZE];
+        char host[ADMIRAL_ENDPOINT_HOST_SIZE];
+        char socketPath[ADMIRAL_ENDPOINT_SOCKET_SIZE];
+        char user[ADMIRAL_ENDPOINT_NAME_SIZE];
+
+        int fields = sscanf(line, "%u %31s %63s %u %107s %31s %u", &id, name, host, &port, socketPath, user, &weight);
+        if (fields == EOF) {
+            continue;
+        }
+
+        if (fields < 4
+            || lmp_admiral_registry_add(id, name, host, port, fields > 4 ? socketPath : NULL, fields > 5 ? user : NULL,
+                                        weight) == -1) {
+            LMP_LOG_ERROR("admiral", "Bad endpoint on line %u of %s", lineNumber, path);
+            fclose(f);
+            return -1;
+        }
+    }
+
+    fclose(f);
+    return 1;
+}
+
+const lmp_admiral_registry_entry* lmp_admiral_map_address_to_endpoint(const struct sockaddr* address, socklen_t length) {
+    lmp_admiral_endpoint_key key;
+    if (lmp_admiral_key_from_address(address, length, &key) == -1) {
+        return NULL;
+    }
+
+    u32 slot = lmp_admiral_hash_key(&key) & (ADMIRAL_REGISTRY_SLOTS - 1);
+    while (registry.slots[slot] != 0) {
+        const lmp_admiral_registry_entry* entry = &registry.endpoints[registry.slots[slot] - 1];
+        if (memcmp(&entry->key, &key, sizeof(key)) == 0) {
+            return entry;
+        }
+
+        slot = (slot + 1) & (ADMIRAL_REGISTRY_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+const lmp_admiral_registry_entry* lmp_admiral_map_connection_to_endpoint(u32 fd) {
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+
+    if (getpeername(fd, (struct sockaddr*)&address, &length) == -1) {
+        return NULL;
+    }
+
+    return lmp_admiral_map_address_to_endpoint((struct sockaddr*)&address, length);
+}
+
+const lmp_admiral_registry_entry* lmp_admiral_map_peer_to_endpoint(u32 fd) {
+    u32 uid;
+    if (lmp_net_get_peer_uid(fd, &uid) == -1) {
+        return NULL;
+    }
+
+    for (u8 id = 0; id < ADMIRAL_MAX_ENDPOINTS; id++) {
+        if (registry.endpoints[id].used && registry.endpoints[id].uid == uid) {
+            return &registry.endpoints[id];
+        }
+    }
+
+    return NULL;
+}
+
+const lmp_admiral_registry_entry* lmp_admiral_map_id_to_endpoint(u8 id) {
+    if (id >= ADMIRAL_MAX_ENDPOINTS || !registry.endpoints[id].used) {
+        return NULL;
+    }
+
+    return &registry.endpoints[id];
+}
+
+// ===============================================================
+// Client
+// ===============================================================
+
+typedef struct {
+    u16 port;
+    s32 fd;
+    s32 datagramFd;
+    pthread_mutex_t mutex;
+    lmp_net_reader reader;
+    mem_arena* arena;
+    u32 failures;
+    u64 retryAt;
+    time_t lastActive;
+    u8 shared;
+    lmp_shm_channel shm;
+} lmp_client;
+
+static lmp_client lmp_clients[] = {
+    [HOTEL] = {ADMIRAL_PORT_HOTEL, -1, -1, PTHREAD_MUTEX_INITIALIZER, {0}, NULL, 0, 0, 0},
+    [SCHEDULER] = {ADMIRAL_PORT_SCHEDULER, -1, -1, PTHREAD_MUTEX_INITIALIZER, {0}, NULL, 0, 0, 0},
+};
+
+static pthread_once_t lmp_client_keepalive_once = PTHREAD_ONCE_INIT;
+
+static lmp_client* lmp_client_lookup(const char* name) {
+    for (u8 id = HOTEL; id <= SCHEDULER; id++) {
+        if (strcmp(name, endpoint[id]) == 0) {
+            return &lmp_clients[id];
+        }
+    }
+
+    return NULL;
+}
+
+static void lmp_client_close(lmp_client* client) {
+    if (client->shared) {
+        lmp_shm_destroy(&client->shm);
+        client->shared = 0;
+    }
+
+    if (client->fd != -1) {
+        close(client->fd);
+        client->fd = -1;
+    }
+}
+
+// NOTE(laith): like lmp_net_send_packet_iov, result->error is only set when the packet itself is
+// bad, a connection that failed just shows in the return value
+static lmp_error lmp_client_send(lmp_client* client, const lmp_packet* packet, lmp_result* result) {
+    if (!client->shared) {
+        return lmp_net_send_packet_iov(client->fd, packet, result);
+    }
+
+    u8 buffer[LMP_PACKET_MAX_SIZE];
+    lmp_packet_serialize(buffer, sizeof(buffer), packet, result);
+    if (result->error != LMP_ERR_NONE) {
+        return result->error;
+    }
+
+    u64 deadline = lmp_net_deadline(LMP_NET_SEND_TIMEOUT_MS);
+    size_t sent = 0;
+
+    while (sent < result->size) {
+        sent += lmp_shm_write(&client->shm, buffer + sent, result->size - sent);
+        if (sent == result->size) {
+            break;
+        }
+
+        lmp_error error = lmp_shm_wait(&client->shm, client->fd, deadline);
+        if (error != LMP_ERR_NONE) {
+            return error;
+        }
+    }
+
+    return LMP_ERR_NONE;
+}
+
+// NOTE(laith): fills the reader from whichever of the socket or the shm channel the session is on,
+// returns 0 when there was nothing to read without blocking and -1 when the connection is gone
+static s8 lmp_client_fill(lmp_client* client, int flags, u64 deadline) {
+    u8 buffer[LMP_PACKET_MAX_SIZE];
+
+    for (;;) {
+        if (client->shared) {
+            size_t bytes = lmp_shm_read(&client->shm, buffer, sizeof(buffer));
+            if (bytes > 0) {
+                return lmp_net_reader_push(&client->reader, buffer, bytes) == LMP_ERR_NONE ? 1 : -1;
+            }
+
+            // NOTE(laith): admiral going away only shows on the socket the session came from
+            if (flags & MSG_DONTWAIT) {
+                ssize_t peeked = recv(client->fd, buffer, 1, MSG_DONTWAIT | MSG_PEEK);
+                return peeked == 0 || (peeked < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ? -1 : 0;
+            }
+
+            if (lmp_shm_park(&client->shm) == 0
+                && lmp_shm_wait(&client->shm, client->fd, deadline) != LMP_ERR_NONE) {
+                return -1;
+            }
+            continue;
+        }
+
+        // NOTE(laith): the socket itself never blocks, a blocking read waits in poll for the deadline
+        if (!(flags & MSG_DONTWAIT) && lmp_net_wait(client->fd, POLLIN, deadline) != LMP_ERR_NONE) {
+            return -1;
+        }
+
+        ssize_t bytes = recv(client->fd, buffer, sizeof(buffer), flags | MSG_DONTWAIT);
+        if (bytes > 0) {
+            return lmp_net_reader_push(&client->reader, buffer, bytes) == LMP_ERR_NONE ? 1 : -1;
+        }
+
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (flags & MSG_DONTWAIT) {
+                return 0;
+            }
+            continue;
+        }
+
+        return -1;
+    }
+}
+
+// NOTE(laith): each failure to reach admiral doubles the wait before the next try
+static void lmp_client_back_off(lmp_client* client) {
+    lmp_client_close(client);
+
+    u32 shift = MIN(client->failures, 16);
+    client->failures++;
+    client->retryAt = lmp_net_now_ms() + MIN((u64)LMP_CLIENT_BACKOFF_MIN_MS << shift, LMP_CLIENT_BACKOFF_MAX_MS);
+}
+
+// NOTE(laith): reads what admiral sent back until a packet of type until shows up, or with
+// MSG_DONTWAIT until there is nothing left to read. INVALIDs for earlier sends get logged on the
+// way. returns -1 when the connection is gone or the reply timed out
+static s8 lmp_client_read_replies(lmp_client* client, int flags, s32 until, lmp_packet* reply) {
+    u64 deadline = lmp_net_deadline(LMP_CLIENT_REPLY_TIMEOUT_SECONDS * 1000);
+
+    for (;;) {
+        for (;;) {
+            lmp_packet packet;
+            lmp_result result;
+            lmp_result_init(&result);
+
+            lmp_error error = lmp_net_reader_next(&client->reader, &packet, &result);
+            if (error == LMP_ERR_INCOMPLETE) {
+                break;
+            }
+
+            if (error != LMP_ERR_NONE) {
+                return -1;
+            }
+
+            if (packet.type == LMP_TYPE_INVALID) {
+                LMP_LOG_WARN("liblmp", "Admiral rejected a packet (%u)", packet.arg);
+            }
+
+            if (packet.type == until) {
+                if (reply) {
+                    *reply = packet;
+                }
+                return 1;
+            }
+        }
+
+        s8 filled = lmp_client_fill(client, flags, deadline);
+        if (filled != 1) {
+            return filled == 0 ? 1 : -1;
+        }
+    }
+}
+
+static const u8 lmp_client_empty_payload[] = {LMP_PAYLOAD_EMPTY};
+
+// NOTE(laith): sends a control packet and waits for admiral to answer it with the same type
+static s8 lmp_client_exchange(lmp_client* client, lmp_type type, lmp_arg arg, lmp_packet* reply) {
+    lmp_packet packet;
+    lmp_result result;
+
+    lmp_packet_init(&packet);
+    packet.version = LMP_VERSION_2;
+    packet.type = type;
+    packet.arg = arg;
+    packet.payload = lmp_client_empty_payload;
+    packet.payload_length = sizeof(lmp_client_empty_payload);
+
+    if (lmp_client_send(client, &packet, &result) != LMP_ERR_NONE) {
+        return -1;
+    }
+
+    return lmp_client_read_replies(client, 0, type, reply);
+}
+
+// NOTE(laith): asks admiral to move the session into shm. the region and eventfds come back
+// attached to the INIT ACCEPT, and an answer without them means the session stays on the socket
+static s8 lmp_client_share(lmp_client* client, lmp_packet* reply) {
+    lmp_packet packet;
+    lmp_result result;
+
+    lmp_packet_init(&packet);
+    packet.version = LMP_VERSION_2;
+    packet.type = LMP_TYPE_INIT;
+    packet.arg = LMP_ARG_INIT_SHM;
+    packet.payload = lmp_client_empty_payload;
+    packet.payload_length = sizeof(lmp_client_empty_payload);
+
+    if (lmp_client_send(client, &packet, &result) != LMP_ERR_NONE) {
+        return -1;
+    }
+
+    u8 buffer[LMP_PACKET_MAX_SIZE];
+    s32 fds[LMP_SHM_FD_COUNT];
+    u32 count = LMP_SHM_FD_COUNT;
+
+    if (lmp_net_wait(client->fd, POLLIN, lmp_net_deadline(LMP_CLIENT_REPLY_TIMEOUT_SECONDS * 1000)) != LMP_ERR_NONE) {
+        return -1;
+    }
+
+    if (lmp_net_recv_fds(client->fd, buffer, sizeof(buffer), fds, &count, &result) != LMP_ERR_NONE
+        || lmp_net_reader_push(&client->reader, buffer, result.size) != LMP_ERR_NONE) {
+        for (u32 i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+
+    if (count == LMP_SHM_FD_COUNT) {
+        client->shared = lmp_shm_attach(&client->shm, fds) == LMP_ERR_NONE;
+    } else {
+        for (u32 i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+    }
+
+    return lmp_client_read_replies(client, 0, LMP_TYPE_INIT, reply);
+}
+
+// NOTE(laith): opens the session on a freshly connected socket with INIT
+static s8 lmp_client_open(lmp_client* client, s32 socketFd, u8 share) {
+    if (client->arena == NULL) {
+        client->arena = arena_create(LMP_NET_READER_CAPACITY + KiB(1));
+        if (client->arena == NULL) {
+            close(socketFd);
+            return -1;
+        }
+
+        lmp_net_reader_init(&client->reader, socketFd, client->arena);
+    }
+
+    client->fd = socketFd;
+    lmp_net_reader_reset(&client->reader, socketFd);
+
+    lmp_packet reply;
+    s8 opened = share ? lmp_client_share(client, &reply)
+        : lmp_client_exchange(client, LMP_TYPE_INIT, LMP_ARG_INIT_INIT, &reply);
+
+    if (opened == -1 || reply.arg != LMP_ARG_INIT_ACCEPT) {
+        lmp_client_close(client);
+        return -1;
+    }
+
+    client->failures = 0;
+    client->lastActive = time(NULL);
+
+    return 1;
+}
+
+static lmp_client_transport lmp_client_get_transport(void) {
+    const char* transport = getenv(LMP_CLIENT_TRANSPORT_ENV);
+
+    if (transport && strcmp(transport, "tcp") == 0) {
+        return LMP_CLIENT_TRANSPORT_TCP;
+    }
+
+    if (transport && strcmp(transport, "shm") == 0) {
+        return LMP_CLIENT_TRANSPORT_SHM;
+    }
+
+    if (transport && strcmp(transport, "udp") == 0) {
+        return LMP_CLIENT_TRANSPORT_UDP;
+    }
+
+    return LMP_CLIENT_TRANSPORT_UNIX;
+}
+
+// NOTE(laith): admiral's unix socket is tried first, it is only there when admiral runs on this
+// host and turns away a process not running as the identity's user, in which case this falls back
+// to tcp with the identity's port bound so admiral can tell who is connecting
+static s8 lmp_client_connect(lmp_client* client) {
+    lmp_client_transport transport = lmp_client_get_transport();
+    lmp_result result;
+    s32 socketFd;
+
+    if (transport != LMP_CLIENT_TRANSPORT_TCP) {
+        socketFd = lmp_net_connect_unix(ADMIRAL_SOCKET_ADMIRAL, &result);
+        if (socketFd != -1 && lmp_client_open(client, socketFd, transport == LMP_CLIENT_TRANSPORT_SHM) == 1) {
+            return 1;
+        }
+    }
+
+    socketFd = lmp_net_connect(ADMIRAL_HOST_ADMIRAL, ADMIRAL_PORT_ADMIRAL, client->port,
+                               LMP_NET_CONNECT_TIMEOUT_MS, &result);
+    if (socketFd == -1) {
+        return -1;
+    }
+
+    lmp_net_set_nodelay(socketFd, 1);
+
+    return lmp_client_open(client, socketFd, 0);
+}
+
+static void* lmp_client_keepalive(void* args) {
+    (void)args;
+
+    for (;;) {
+        sleep(1);
+
+        for (u8 id = HOTEL; id <= SCHEDULER; id++) {
+            lmp_client* client = &lmp_clients[id];
+
+            // NOTE(laith): a client someone is holding is busy, which is as good as a ping. this
+            // never waits behind a send, and a send only waits behind a ping admiral isn't answering
+            if (pthread_mutex_trylock(&client->mutex) != 0) {
+                continue;
+            }
+
+            if (client->fd != -1 && time(NULL) - client->lastActive >= LMP_CLIENT_KEEPALIVE_SECONDS) {
+                if (lmp_client_exchange(client, LMP_TYPE_PING, LMP_ARG_PING, NULL) == -1) {
+                    LMP_LOG_WARN("liblmp", "Admiral stopped answering pings, dropping connection");
+                    lmp_client_close(client);
+                }
+
+                client->lastActive = time(NULL);
+            }
+
+            pthread_mutex_unlock(&client->mutex);
+        }
+    }
+
+    return NULL;
+}
+
+static void lmp_client_start_keepalive(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, lmp_client_keepalive, NULL) == 0) {
+        pthread_detach(thread);
+    }
+}
+
+// NOTE(laith): endpoint is the name of the service sending, like "scheduler". a connection admiral
+// dropped while this side was quiet only shows up once it is read from, so that is checked first
+// without blocking, and a send that fails on a connection that was already open gets one retry on
+// a fresh one. while backing off this returns LMP_ERR_CLOSED straight away
+lmp_error lmp_net_send_packet_to_admiral(char* endpoint, const lmp_packet* packet, lmp_result* result) {
+    lmp_result_init(result);
+
+    lmp_client* client = endpoint ? lmp_client_lookup(endpoint) : NULL;
+    if (client == NULL) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return result->error;
+    }
+
+    if (lmp_client_get_transport() == LMP_CLIENT_TRANSPORT_UDP) {
+        return lmp_net_send_datagrams_to_admiral(endpoint, packet, 1, result);
+    }
+
+    pthread_once(&lmp_client_keepalive_once, lmp_client_start_keepalive);
+
+    pthread_mutex_lock(&client->mutex);
+
+    lmp_error error = LMP_ERR_CLOSED;
+    for (u32 attempt = 0; attempt < 2; attempt++) {
+        if (client->fd != -1 && lmp_client_read_replies(client, MSG_DONTWAIT, -1, NULL) == -1) {
+            lmp_client_close(client);
+        }
+
+        if (client->fd == -1) {
+            if (lmp_net_now_ms() < client->retryAt) {
+                break;
+            }
+
+            if (lmp_client_connect(client) == -1) {
+                lmp_client_back_off(client);
+                break;
+            }
+
+            attempt++;
+        }
+
+        error = lmp_client_send(client, packet, result);
+        if (error == LMP_ERR_NONE || result->error != LMP_ERR_NONE) {
+            break;
+        }
+
+        error = LMP_ERR_CLOSED;
+        lmp_client_close(client);
+    }
+
+    if (error == LMP_ERR_NONE) {
+        client->lastActive = time(NULL);
+    }
+
+    pthread_mutex_unlock(&client->mutex);
+
+    result->error = error;
+    return error;
+}
+
+// NOTE(laith): the datagram socket is bound to the identity's port like the stream one and kept
+// for the life of the process. a refused datagram only means admiral was not up for it, the next
+// ones still go out on the same socket
+lmp_error lmp_net_send_datagrams_to_admiral(char* endpoint, const lmp_packet* packets, size_t count, lmp_result* result) {
+    lmp_result_init(result);
+
+    lmp_client* client = endpoint ? lmp_client_lookup(endpoint) : NULL;
+    if (client == NULL) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return result->error;
+    }
+
+    pthread_mutex_lock(&client->mutex);
+
+    if (client->datagramFd == -1) {
+        client->datagramFd = lmp_net_open_datagram(ADMIRAL_HOST_ADMIRAL, ADMIRAL_PORT_ADMIRAL, client->port, result);
+    }
+
+    lmp_error error = LMP_ERR_CLOSED;
+    if (client->datagramFd != -1) {
+        error = lmp_net_send_datagrams(client->datagramFd, packets, count, NULL, 0, result);
+    }
+
+    pthread_mutex_unlock(&client->mutex);
+
+    result->error = error;
+    return error;
+}
+
+// NOTE(laith): ends the session with a TERM so admiral does not have to wait out the idle timeout
+void lmp_net_disconnect_from_admiral(char* endpoint) {
+    lmp_client* client = endpoint ? lmp_client_lookup(endpoint) : NULL;
+    if (client == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&client->mutex);
+
+    if (client->fd != -1) {
+        lmp_packet packet;
+        lmp_result result;
+
+        lmp_packet_init(&packet);
+        packet.version = LMP_VERSION_2;
+        packet.type = LMP_TYPE_TERM;
+        packet.arg = LMP_ARG_TERM_CLEAN;
+        packet.payload = lmp_client_empty_payload;
+        packet.payload_length = sizeof(lmp_client_empty_payload);
+
+        lmp_client_send(client, &packet, &result);
+        lmp_client_close(client);
+    }
+
+    pthread_mutex_unlock(&client->mutex);
+}
@@ -23,6 +23,8 @@
 #define LIBLMP_H
 #include <stddef.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
 #include "lt_base.h"
 #include "lmp.h"
 #define LT_ARENA_IMPLEMENTATION
@@ -32,11 +34,177 @@
 // Net
 // ===============================================================
 
+#define LMP_NET_READER_CAPACITY (LMP_PACKET_MAX_SIZE * 4)
+#define LMP_NET_SEND_BATCH 64 // packets per sendmsg
+#define LMP_NET_DATAGRAM_BATCH 32 // datagrams per sendmmsg or recvmmsg
+
+// NOTE(laith): deadlines are absolute milliseconds on the monotonic clock, from lmp_net_deadline.
+// a send that hits its deadline may have written part of a packet, so the connection has to be
+// dropped after a LMP_ERR_TIMEOUT
+#define LMP_NET_NO_DEADLINE ((u64)-1)
+#define LMP_NET_CONNECT_TIMEOUT_MS 3000
+#define LMP_NET_SEND_TIMEOUT_MS 5000
+#define LMP_NET_RECV_TIMEOUT_MS 5000  // longest wait for more bytes in the middle of a frame
+#define LMP_NET_FRAME_TIMEOUT_MS 10000 // longest a whole frame may take once it has started
+
+// NOTE(laith): one per connection. bytes read past the end of a packet stay in the buffer for the
+// next call, and packets come back as views into the buffer. a view is only good until the next
+// fill, which may slide the unread bytes back to the front of the buffer
+typedef struct {
+    u32 fd;
+    u8* buffer;
+    size_t capacity;
+    size_t start;
+    size_t end;
+} lmp_net_reader;
+
+// NOTE(laith): every packet fits in one datagram, so over udp a datagram is exactly one packet and
+// there is no reader. a datagram that was cut short on the way in comes back with a length of 0
+typedef struct {
+    u8 data[LMP_PACKET_MAX_SIZE];
+    size_t length;
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+} lmp_net_datagram;
+
 // TODO(laith): this about making these two static helpers within the lib c file to prevent extrernal linkage
 lmp_error lmp_net_send_packet(u32 fd, const lmp_packet* packet, lmp_result* result);
+lmp_error lmp_net_send_packet_iov(u32 fd, const lmp_packet* packet, lmp_result* result);
+lmp_error lmp_net_send_batch(u32 fd, const lmp_packet* packets, size_t count, lmp_result* result);
+lmp_error lmp_net_set_nodelay(u32 fd, u8 enabled);
+lmp_error lmp_net_set_cork(u32 fd, u8 enabled);
+// NOTE(laith): reads exactly one packet, anything a v1/v2 peer pipelined behind it is lost
 lmp_error lmp_net_recv_packet(u32 fd, u8* buffer, size_t size, lmp_packet* packet, lmp_result* result);
-char* lmp_net_get_client(u32 fd, mem_arena* arena);
+lmp_error lmp_net_recv_packet_deadline(u32 fd, u8* buffer, size_t size, u64 deadline, lmp_packet* packet, lmp_result* result);
+s32 lmp_net_connect(const char* host, u16 port, u16 local_port, u32 timeout_ms, lmp_result* result);
+s32 lmp_net_connect_unix(const char* path, lmp_result* result);
+s8 lmp_net_get_peer_uid(u32 fd, u32* uid);
+s32 lmp_net_open_datagram(const char* host, u16 port, u16 local_port, lmp_result* result);
+lmp_error lmp_net_send_datagrams(u32 fd, const lmp_packet* packets, size_t count,
+                                 const struct sockaddr* to, socklen_t to_length, lmp_result* result);
+// NOTE(laith): sends replies[i] back to whoever sent requests[i], all of them in one sendmmsg per
+// LMP_NET_DATAGRAM_BATCH
+lmp_error lmp_net_reply_datagrams(u32 fd, const lmp_packet* replies, const lmp_net_datagram* const* requests,
+                                  size_t count, lmp_result* result);
+s32 lmp_net_recv_datagrams(u32 fd, lmp_net_datagram* datagrams, u32 count);
+lmp_error lmp_net_send_fds(u32 fd, const u8* data, size_t size, const s32* fds, u32 count);
+lmp_error lmp_net_recv_fds(u32 fd, u8* buffer, size_t size, s32* fds, u32* count, lmp_result* result);
+u64 lmp_net_now_ms(void);
+u64 lmp_net_deadline(u32 timeout_ms);
 lmp_error lmp_net_send_packet_to_admiral(char* endpoint, const lmp_packet* packet, lmp_result* result);
+lmp_error lmp_net_send_datagrams_to_admiral(char* endpoint, const lmp_packet* packets, size_t count, lmp_result* result);
+void lmp_net_disconnect_from_admiral(char* endpoint);
+
+void lmp_net_reader_init(lmp_net_reader* reader, u32 fd, mem_arena* arena);
+void lmp_net_reader_reset(lmp_net_reader* reader, u32 fd);
+lmp_error lmp_net_reader_fill(lmp_net_reader* reader);
+lmp_error lmp_net_reader_push(lmp_net_reader* reader, const u8* data, size_t size);
+lmp_error lmp_net_reader_next(lmp_net_reader* reader, lmp_packet* packet, lmp_result* result);
+lmp_error lmp_net_reader_recv(lmp_net_reader* reader, lmp_packet* packet, lmp_result* result);
+lmp_error lmp_net_reader_recv_deadline(lmp_net_reader* reader, u64 deadline, lmp_packet* packet, lmp_result* result);
+
+// ===============================================================
+// Shm
+// ===============================================================
+
+// NOTE(laith): a session between a service and admiral on the same host can move off the socket
+// into one shared memory region holding a byte ring per direction, read and written exactly like
+// the socket it replaces. each ring has one writer and one reader, so head and tail only ever
+// move forward on their own side and sit on cache lines of their own. a side that runs dry or
+// out of room says so in the ring and sleeps on its eventfd, and the other side only writes to
+// that eventfd when it finds the flag set, so a busy ring costs no syscalls at all.
+//
+// admiral creates the region when a local client sends INIT with LMP_ARG_INIT_SHM and passes its
+// fds back with the INIT ACCEPT in the order below. linux only, elsewhere admiral just answers
+// with a plain INIT ACCEPT and the session stays on the socket
+#define LMP_SHM_RING_CAPACITY KiB(64) // power of two
+#define LMP_SHM_CACHE_LINE 64
+
+#define LMP_SHM_FD_REGION 0
+#define LMP_SHM_FD_SERVICE_EVENT 1 // the service sleeps on it, admiral wakes it
+#define LMP_SHM_FD_ADMIRAL_EVENT 2 // admiral sleeps on it, the service wakes it
+#define LMP_SHM_FD_COUNT 3
+
+typedef struct {
+    u32 head __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u32 writerWaiting;
+    u32 tail __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u32 readerWaiting;
+    u8 data[LMP_SHM_RING_CAPACITY] __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+} lmp_shm_ring;
+
+typedef struct {
+    lmp_shm_ring toAdmiral;
+    lmp_shm_ring toService;
+} lmp_shm_region;
+
+typedef struct {
+    lmp_shm_region* region;
+    lmp_shm_ring* in;
+    lmp_shm_ring* out;
+    s32 fds[LMP_SHM_FD_COUNT];
+    s32 eventFd;     // this side sleeps on it
+    s32 peerEventFd; // the other side sleeps on it
+    u64 wakeups;
+} lmp_shm_channel;
+
+lmp_error lmp_shm_create(lmp_shm_channel* channel);
+lmp_error lmp_shm_attach(lmp_shm_channel* channel, const s32* fds);
+void lmp_shm_destroy(lmp_shm_channel* channel);
+// NOTE(laith): both copy as much as there is data or room for and return how much that was. a write
+// that could not take everything leaves the writer flagged as waiting for room
+size_t lmp_shm_write(lmp_shm_channel* channel, const u8* data, size_t size);
+size_t lmp_shm_read(lmp_shm_channel* channel, u8* buffer, size_t size);
+// NOTE(laith): flags the reading side as asleep, returns 0 when it may go to sleep on eventFd
+// and 1 when data arrived in the meantime and it has to read again instead
+s8 lmp_shm_park(lmp_shm_channel* channel);
+// NOTE(laith): sleeps on eventFd until woken or the deadline, and LMP_ERR_CLOSED if socketFd, the
+// socket the session was set up over, hangs up first
+lmp_error lmp_shm_wait(lmp_shm_channel* channel, u32 socketFd, u64 deadline);
+// NOTE(laith): resets eventFd after a wakeup, for callers that sleep on it in their own event loop
+void lmp_shm_drain(lmp_shm_channel* channel);
+
+// ===============================================================
+// Stream
+// ===============================================================
+
+// NOTE(laith): payloads bigger than one packet go out as a stream of version 3 SEND_FRAGMENT
+// packets. the receiver copies each fragment straight to its place in one arena allocation. a
+// stream that goes LMP_STREAM_IDLE_TIMEOUT_MS without a fragment is dropped, so a sender that dies
+// halfway can't hold on to a slot for good
+//
+// admiral holds every fragment of a stream in its queue until the last one is in, so a stream
+// going through it is also capped by its destination's share of the queue. that is capacity / 64
+// fragments of up to 1481 bytes, about 92 KiB with the default capacity, see
+// ADMIRAL_QUEUE_DESTINATION_SHARE
+#define LMP_STREAM_MAX_SIZE MiB(8)
+#define LMP_STREAM_MAX_ACTIVE 8
+#define LMP_STREAM_IDLE_TIMEOUT_MS 30000
+#define LMP_STREAM_SEND_BATCH 64 // fragments per writev
+
+typedef struct {
+    u16 id;
+    u8 active;
+    u8* data;
+    u32 total;
+    u32 received;
+    u64 lastActivity;
+} lmp_stream;
+
+typedef struct {
+    mem_arena* arena;
+    lmp_stream streams[LMP_STREAM_MAX_ACTIVE];
+} lmp_stream_reassembler;
+
+// NOTE(laith): envelope is copied in front of every fragment header, admiral traffic puts the
+// [dest][sender] routing bytes there. it can be NULL
+lmp_error lmp_stream_send(u32 fd, const u8* envelope, size_t envelope_length, u16 stream_id,
+                          const u8* data, size_t length, lmp_result* result);
+void lmp_stream_reassembler_init(lmp_stream_reassembler* reassembler, mem_arena* arena);
+// NOTE(laith): returns LMP_ERR_INCOMPLETE until the last fragment of a stream arrives, then
+// points data at the whole payload in the reassembler arena
+lmp_error lmp_stream_reassemble(lmp_stream_reassembler* reassembler, const lmp_packet* packet,
+                                u8** data, size_t* length, lmp_result* result);
 
 // ===============================================================
 // Log
@@ -47,38 +215,154 @@ lmp_error lmp_net_send_packet_to_admiral(char* endpoint, const lmp_packet* packe
 #define LMP_LOG_COLOR_ERROR "\x1b[31m"  // Red
 #define LMP_LOG_COLOR_RESET "\x1b[0m"
 
+// NOTE(laith): lines are not formatted by the thread that logs them. it copies the format and its
+// arguments into a fixed size record in a ring of its own, and one background thread formats
+// records from every ring in timestamp order and writes them out in batches. it sleeps until the
+// first record after a batch wakes it. when a ring is full the record is dropped and counted, and
+// the flusher reports the count with its next batch
+#define LMP_LOG_RING_RECORDS 1024 // per thread, power of two
+#define LMP_LOG_RECORD_ARGS 8
+#define LMP_LOG_RECORD_STRINGS 224 // bytes for copies of %s arguments, longer ones are cut short
+#define LMP_LOG_FLUSH_INTERVAL_MS 10
+#define LMP_LOG_BATCH_SIZE KiB(64)
+#define LMP_LOG_LINE_SIZE 1024
+#define LMP_LOG_LEVEL_ENV "LMP_LOG_LEVEL" // info, warn or error
+#define LMP_LOG_FORMAT_ENV "LMP_LOG_FORMAT" // text or binary
+#define LMP_LOG_BINARY_MAGIC "LMPLOG1\n"
+
+// NOTE(laith): levels under LMP_LOG_MIN_LEVEL are compiled out of the LMP_LOG macros, build with
+// -DLMP_LOG_MIN_LEVEL=LMP_PRINT_TYPE_WARN to drop every INFO line
+#ifndef LMP_LOG_MIN_LEVEL
+#define LMP_LOG_MIN_LEVEL LMP_PRINT_TYPE_INFO
+#endif
+
 typedef enum {
     LMP_PRINT_TYPE_INFO,
     LMP_PRINT_TYPE_WARN,
     LMP_PRINT_TYPE_ERROR
 } lmp_log_print_type;
 
+typedef enum {
+    LMP_LOG_ARG_INT,
+    LMP_LOG_ARG_UINT,
+    LMP_LOG_ARG_DOUBLE,
+    LMP_LOG_ARG_STRING,
+    LMP_LOG_ARG_POINTER
+} lmp_log_arg_type;
+
+// NOTE(laith): service and format are kept as pointers, so they have to be string literals or
+// live as long as the process. %s arguments are copied into strings and args holds their offset,
+// doubles are kept by their bits
+typedef struct {
+    u64 timestamp; // nanoseconds since the epoch
+    const char* service;
+    const char* format;
+    u8 level;
+    u8 argCount;
+    u8 argTypes[LMP_LOG_RECORD_ARGS];
+    u64 args[LMP_LOG_RECORD_ARGS];
+    char strings[LMP_LOG_RECORD_STRINGS];
+} lmp_log_record;
+
+extern lmp_log_print_type lmp_log_level;
+
+// NOTE(laith): the level is checked before the arguments are evaluated, so a line that is turned
+// off at runtime costs one compare and one under LMP_LOG_MIN_LEVEL costs nothing
+#define LMP_LOG(type, service, ...) \
+    do { \
+        if ((type) >= LMP_LOG_MIN_LEVEL && (type) >= __atomic_load_n(&lmp_log_level, __ATOMIC_RELAXED)) { \
+            lmp_log_write((type), (service), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LMP_LOG_INFO(service, ...) LMP_LOG(LMP_PRINT_TYPE_INFO, service, __VA_ARGS__)
+#define LMP_LOG_WARN(service, ...) LMP_LOG(LMP_PRINT_TYPE_WARN, service, __VA_ARGS__)
+#define LMP_LOG_ERROR(service, ...) LMP_LOG(LMP_PRINT_TYPE_ERROR, service, __VA_ARGS__)
+
+void lmp_log_write(lmp_log_print_type type, const char* service, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
 void lmp_log_print(const char* service, const char* message, lmp_log_print_type type);
+void lmp_log_set_level(lmp_log_print_type type);
+void lmp_log_flush(void);
+u64 lmp_log_dropped(void);
+size_t lmp_log_format_record(const lmp_log_record* record, char* buffer, size_t size);
 
 // ===============================================================
 // Admiral
 // ===============================================================
 
 #define ADMIRAL_BACKLOG 15
-#define ADMIRAL_QUEUE_CAPACITY 50
-#define ADMIRAL_QUEUE_READ_RETRY_SECONDS 30
+
+// NOTE(laith): slots hold payloads up to ADMIRAL_QUEUE_INLINE_PAYLOAD themselves, which keeps a slot
+// at 256 bytes so the queue can be made hundreds of thousands deep. anything bigger borrows one of
+// capacity / ADMIRAL_QUEUE_LARGE_SHARE full size buffers. admiral takes the capacity with -q. one
+// destination gets at most 1 / ADMIRAL_QUEUE_DESTINATION_SHARE of the slots and of the large buffers
+#define ADMIRAL_QUEUE_CAPACITY 4096
+#define ADMIRAL_QUEUE_MAX_CAPACITY (1u << 22)
+#define ADMIRAL_QUEUE_INLINE_PAYLOAD 184
+#define ADMIRAL_QUEUE_LARGE_SHARE 32
+#define ADMIRAL_QUEUE_DESTINATION_SHARE 2
+
+// NOTE(laith): clients keep their connection open across packets. INIT opens a session, PING is
+// answered to show admiral is alive and TERM closes it. a SEND does not need the INIT first, so a
+// one-shot sender can still connect, send and hang up. a connection that sends nothing for
+// ADMIRAL_IDLE_TIMEOUT_SECONDS gets closed
+#define ADMIRAL_MAX_CONNECTIONS 4096
+#define ADMIRAL_IDLE_TIMEOUT_SECONDS 120
+#define ADMIRAL_FRAME_TIMEOUT_SECONDS (LMP_NET_FRAME_TIMEOUT_MS / 1000)
+#define ADMIRAL_SEND_TIMEOUT_SECONDS (LMP_NET_SEND_TIMEOUT_MS / 1000)
+#define ADMIRAL_TIMER_INTERVAL_SECONDS 1
+#define ADMIRAL_EPOLL_EVENTS 64
+#define ADMIRAL_OUTBOX_SIZE 1024
+#define ADMIRAL_URING_ENTRIES 256
+#define ADMIRAL_URING_BUFFERS 512
+#define ADMIRAL_MAX_WORKERS 64
 
 #define ADMIRAL_PORT_ADMIRAL 5321
 #define ADMIRAL_HOST_ADMIRAL "100.109.120.90" // inferno
-#define ADMIRAL_ENDPOINT_ADMIRAL "100.109.120.90:5321"
 
 #define ADMIRAL_PORT_HOTEL 4200
 #define ADMIRAL_HOST_HOTEL "100.103.121.7" // nuke
-#define ADMIRAL_ENDPOINT_HOTEL "100.103.121.7:4200"
 
 #define ADMIRAL_PORT_SCHEDULER 6767
 #define ADMIRAL_HOST_SCHEDULER "100.103.121.7" // nuke
-#define ADMIRAL_ENDPOINT_SCHEDULER "100.103.121.7:6767"
 
-typedef struct {
+// NOTE(laith): services on the same host as whoever they talk to go over a unix socket instead,
+// tried before the address above. there the peer is known by the user it runs as, so each service
+// needs its own user named below, and a peer running as anyone else is turned away
+#define ADMIRAL_SOCKET_ADMIRAL "/run/lions/admiral.sock"
+#define ADMIRAL_SOCKET_HOTEL "/run/lions/hotel.sock"
+#define ADMIRAL_SOCKET_SCHEDULER "/run/lions/scheduler.sock"
+
+#define ADMIRAL_USER_ADMIRAL "admiral"
+#define ADMIRAL_USER_HOTEL "hotel"
+#define ADMIRAL_USER_SCHEDULER "scheduler"
+
+// NOTE(laith): admiral reads its endpoints from ADMIRAL_CONFIG_PATH at startup, one per line as
+//
+//     <id> <name> <host> <port> [socket] [user] [weight]
+//
+// the socket defaults to ADMIRAL_SOCKET_DIRECTORY/<name>.sock, the user to the name and the weight,
+// its share of the forwarding thread next to the other destinations, to 1. ids are
+// the routing digit in front of a payload, so they go from 0 to ADMIRAL_MAX_ENDPOINTS - 1. without
+// a config file the endpoints above are used
+#define ADMIRAL_CONFIG_PATH "/etc/lions/admiral.conf"
+#define ADMIRAL_SOCKET_DIRECTORY "/run/lions"
+#define ADMIRAL_MAX_ENDPOINTS 10
+#define ADMIRAL_REGISTRY_SLOTS 32 // power of two, at least twice ADMIRAL_MAX_ENDPOINTS
+#define ADMIRAL_MAX_WEIGHT 64
+#define ADMIRAL_ENDPOINT_NAME_SIZE 32
+#define ADMIRAL_ENDPOINT_HOST_SIZE 64
+#define ADMIRAL_ENDPOINT_SOCKET_SIZE 108
+
+// NOTE(laith): next belongs to whoever dequeued the message, admiral threads it into its lanes
+typedef struct lmp_admiral_message {
     u8 destinationId;
     u8 senderId;
     lmp_packet packet;
+    struct lmp_admiral_message* next;
+    u64 walRecord; // where the message sits in the write-ahead log, 0 when it is not in one
+    u32 fragments; // set by the scheduler, how many messages from this one on go out together
 } lmp_admiral_message;
 
 typedef struct {
@@ -86,41 +370,370 @@ typedef struct {
     u8 id;
 } lmp_admiral_message_endpoint_metadata;
 
+// NOTE(laith): with -d admiral appends every message it accepts to a log of fixed size segment
+// files under that directory, each one mapped into memory. appending is a memcpy under a lock, and
+// a flusher thread msyncs whatever changed ADMIRAL_WAL_COMMIT_INTERVAL_MS after the first write it
+// sees, so one flush commits the whole batch. a crash loses at most that window of messages.
+//
+// a record gets marked delivered in place once admiral is done with it, which is the checkpoint
+// replay goes by. a segment that is full and fully delivered gets deleted. on startup every record
+// not marked yet is replayed in the order it was written, ADMIRAL_WAL_REPLAY_BATCH records at a
+// time by the forwarding thread as the queue makes room for them
+#define ADMIRAL_WAL_SEGMENT_SIZE MiB(4)
+#define ADMIRAL_WAL_MAX_SEGMENTS 64 // power of two
+#define ADMIRAL_WAL_COMMIT_INTERVAL_MS 5
+#define ADMIRAL_WAL_PATH_SIZE 256
+#define ADMIRAL_WAL_REPLAY_BATCH 1024
+
+// NOTE(laith): followed by the packet as it came off the wire and padded out to 8 bytes. the
+// checksum covers all of it but delivered and queued, so replay stops at a record a crash cut
+// short. a zero length is the end of what was written to the segment. queued only means anything
+// to the admiral that set it, opening the log clears it
 typedef struct {
-    mem_arena* arena;
-    lmp_admiral_message** messages;
-    u8 size;
-    u8 capacity;
-    u8 head;
-    u8 tail;
+    u32 length;
+    u32 checksum;
+    u8 destinationId;
+    u8 senderId;
+    u8 delivered;
+    u8 queued;
+} lmp_admiral_wal_record;
+
+typedef struct {
+    u32 id; // 0 when the slot is free
+    u8* map;
+    u32 used;
+    u32 appended;
+    u32 completed;
+    u32 sealed;
+    u32 dirty;
+} lmp_admiral_wal_segment;
+
+// NOTE(laith): a segment lives in slot id & (ADMIRAL_WAL_MAX_SEGMENTS - 1) until it is deleted, so
+// when the oldest one still has undelivered messages a full table turns new messages away
+//
+// while replaying, cursor is the oldest record that is neither delivered nor in the queue and scan
+// is where the current sweep through the log carries on. a sweep skips every destination it found
+// over its share for the rest of the way, so one destination's messages still go in order. until
+// the cursor reaches the end of the log new messages only go into the log and the sweep picks
+// them up too, so nothing new overtakes what the last run left behind. replayIdle is appends plus
+// completions when a sweep last got nowhere, it is not tried again until one of them moves
+typedef struct {
+    char directory[ADMIRAL_WAL_PATH_SIZE];
+    lmp_admiral_wal_segment segments[ADMIRAL_WAL_MAX_SEGMENTS];
+    lmp_admiral_wal_segment* current;
+    u32 nextId;
+    u32 dirty;
     pthread_mutex_t mutex;
+    pthread_cond_t commit;
+
+    u32 replaying;
+    u32 cursorSegment;
+    u32 cursorOffset;
+    u32 scanSegment;
+    u32 scanOffset;
+    u8 blocked[ADMIRAL_MAX_ENDPOINTS];
+    u64 appends;
+    u64 completions;
+    u64 replayIdle;
+} lmp_admiral_wal;
+
+// NOTE(laith): a ring of u32 indices any number of threads can push into and pop from. every cell
+// carries a sequence number that says whose turn it is: pos when it is free for the push that
+// claims pos, pos + 1 once the index is in, and pos + size once a pop took it out again. pushes
+// and pops only race on their own position with a CAS, and those sit on their own cache lines.
+// positions are 64 bit and only ever masked, so they never wrap in practice
+typedef struct {
+    u64 sequence;
+    u32 index;
+} lmp_admiral_queue_cell;
+
+typedef struct {
+    u64 pushPosition __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u64 popPosition __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    lmp_admiral_queue_cell* cells __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u64 mask;
+} lmp_admiral_queue_ring;
+
+// NOTE(laith): a bounded lock-free queue any number of threads can enqueue into and dequeue from.
+// messages sit in slots, and which slots wait to be dequeued and which are free is kept in index
+// rings, the large buffers get a free ring of their own. so slots can come back in any order, a
+// message the consumer holds on to only ever keeps its own slot. payloads are copied into the
+// slot, so a dequeued message is read straight out of it until it is handed back with
+// lmp_admiral_queue_release
+//
+// a consumer that finds the ring empty flags itself as waiting and sleeps on waitFd, and a producer
+// only writes to wakeFd when it finds that flag set, the same handshake the shm rings use. so an
+// idle admiral sits in poll without burning anything and a busy one never makes a syscall for it.
+// waitFd can go straight into an event loop, see lmp_admiral_queue_park. on linux both are one
+// eventfd, elsewhere the two ends of a pipe
+typedef struct {
+    lmp_admiral_message message;
+    u32 large; // index + 1 of the large buffer holding the payload, 0 when it is inline
+    u8 payload[ADMIRAL_QUEUE_INLINE_PAYLOAD];
+} __attribute__((aligned(LMP_SHM_CACHE_LINE))) lmp_admiral_queue_slot;
+
+// NOTE(laith): how much of the queue one destination holds, from the moment a message for it is
+// accepted until it is released. a destination that stops taking messages fills its share and
+// then gets its messages turned away, everyone else keeps the rest
+typedef struct {
+    u32 slots;
+    u32 large;
+} __attribute__((aligned(LMP_SHM_CACHE_LINE))) lmp_admiral_queue_share;
+
+#define ADMIRAL_QUEUE_ABORTS 64
+
+typedef struct {
+    u8 senderId;
+    u16 streamId;
+} lmp_admiral_stream_abort;
+
+typedef struct {
+    lmp_admiral_queue_ring ready;
+    lmp_admiral_queue_ring freeSlots;
+    lmp_admiral_queue_ring freeLarge;
+    u32 consumerWaiting __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u32 spilling;
+    lmp_admiral_queue_slot* slots __attribute__((aligned(LMP_SHM_CACHE_LINE)));
+    u8 (*large)[LMP_PACKET_PAYLOAD_MAX_SIZE];
+    lmp_admiral_queue_share shares[ADMIRAL_MAX_ENDPOINTS];
+    u32 shareSlots;
+    u32 shareLarge;
+    s32 waitFd;
+    s32 wakeFd;
+    mem_arena* arena;
+
+    // NOTE(laith): with a spill file, a message that finds no room goes to disk instead of being
+    // rejected. once anything is on disk every new message follows it there until the consumer
+    // has moved it all back into the ring, so one sender's messages never overtake each other. a
+    // spilled message still counts against its destination's share
+    pthread_mutex_t spillMutex;
+    s32 spillFd;
+    u64 spillRead;
+    u64 spillWrite;
+
+    lmp_admiral_wal* wal; // NULL unless admiral runs with -d
+
+    // NOTE(laith): streams a network thread gave up on partway, for the forwarding thread to drop
+    // whatever it holds of them. when the list is full the stream waits out its idle timeout instead
+    pthread_mutex_t abortMutex;
+    lmp_admiral_stream_abort aborts[ADMIRAL_QUEUE_ABORTS];
+    u32 abortCount;
 } lmp_admiral_queue;
 
-// NOTE(laith): this will be updated to add all the services that admiral will support
-// put new endpoints in between hotel and scheduler, also add it to lmp_admiral_map_client_to_endpoint
+// NOTE(laith): the forwarding thread keeps what it dequeued in a lane per destination, one set of
+// lanes for LMP_FLAGS_PRIORITY and one for everything else. priority lanes are always served
+// first, and within a set deficit round robin hands out ADMIRAL_LANE_QUANTUM payload bytes per
+// turn times the endpoint weight, so a flood for one slow destination only ever costs everyone
+// else a turn. messages stay in their queue slots, the lanes just link them through next, and how
+// many a lane can pile up is bounded by its destination's share of the queue
+#define ADMIRAL_LANE_PRIORITY 0
+#define ADMIRAL_LANE_BULK 1
+#define ADMIRAL_LANE_CLASSES 2
+#define ADMIRAL_LANE_QUANTUM LMP_PACKET_PAYLOAD_MAX_SIZE // at least one full payload, so a turn never comes up empty
+
+typedef struct {
+    lmp_admiral_message* head;
+    lmp_admiral_message* tail;
+    u64 deficit;
+} lmp_admiral_lane;
+
+typedef struct {
+    lmp_admiral_lane lanes[ADMIRAL_MAX_ENDPOINTS];
+    u64 pending;
+    u8 current;
+    u8 turnStarted;
+} lmp_admiral_lane_class;
+
+// NOTE(laith): the fragments of a stream are held back until its last one is in and then move
+// into their lane together, so a stream goes out whole or not at all. one that is aborted or goes
+// LMP_STREAM_IDLE_TIMEOUT_MS without a fragment is dropped along with everything held of it
+#define ADMIRAL_HELD_STREAMS 64
+
+typedef struct {
+    lmp_admiral_message* head;
+    lmp_admiral_message* tail;
+    u64 lastActivity;
+    u32 fragments;
+    u32 received;
+    u32 total;
+    u16 streamId;
+    u8 senderId;
+    u8 used;
+} lmp_admiral_held_stream;
+
+// NOTE(laith): a destination that could not be reached sits out until retryAt, with the wait
+// doubling from ADMIRAL_RETRY_MIN_MS up to ADMIRAL_RETRY_MAX_MS while it stays down. its messages
+// wait in the lane meanwhile instead of each one stalling the thread on a connect
+#define ADMIRAL_RETRY_MIN_MS 250
+#define ADMIRAL_RETRY_MAX_MS 30000
+
+typedef struct {
+    lmp_admiral_lane_class classes[ADMIRAL_LANE_CLASSES];
+    lmp_admiral_lane_class* picked;
+    u64 retryAt[ADMIRAL_MAX_ENDPOINTS];
+    u32 backoff[ADMIRAL_MAX_ENDPOINTS];
+    lmp_admiral_held_stream held[ADMIRAL_HELD_STREAMS];
+    lmp_admiral_queue* queue; // where dropped messages are released to
+} lmp_admiral_scheduler;
+
+// NOTE(laith): the endpoints liblmp itself knows by name. services admiral routes to come from
+// its config file, these only need to grow for a service that sends through lmp_net_send_packet_to_admiral
 typedef enum {
     ADMIRAL,
     HOTEL,
     SCHEDULER
 } lmp_admiral_endpoint;
 
+// NOTE(laith): ipv4 addresses are kept v4 mapped so both families hash the same way, the port is
+// in host order
+typedef struct {
+    u8 address[16];
+    u16 port;
+} lmp_admiral_endpoint_key;
+
+typedef struct {
+    u8 id;
+    u8 used;
+    u16 port;
+    s64 uid;
+    lmp_admiral_endpoint_key key;
+    char name[ADMIRAL_ENDPOINT_NAME_SIZE];
+    char host[ADMIRAL_ENDPOINT_HOST_SIZE];
+    char socket[ADMIRAL_ENDPOINT_SOCKET_SIZE];
+    char user[ADMIRAL_ENDPOINT_NAME_SIZE];
+    u32 weight;
+} lmp_admiral_registry_entry;
+
+// NOTE(laith): replies are written into the outbox and flushed as far as the socket takes them,
+// whatever is left goes out when the socket says it is writable again
+typedef struct lmp_admiral_connection {
+    s32 fd;
+    const lmp_admiral_registry_entry* endpoint;
+    lmp_net_reader reader;
+
+    u8* outbox;
+    size_t outboxLength;
+    size_t outboxInFlight;
+    u32 generation;
+
+    time_t lastActive;
+    // NOTE(laith): when the unfinished frame in the reader started and when the outbox stopped
+    // draining, 0 when there is none. a peer that sits on either past its timeout is dropped
+    time_t frameStarted;
+    time_t writeStarted;
+    u8 streaming;
+    u16 streamId;
+    u8 local;
+
+    // NOTE(laith): set once the session moved into shm. the socket stays open so the client
+    // hanging up is still seen, everything else goes through the channel
+    u8 shared;
+    u8 sharedWatched;
+    lmp_shm_channel shm;
+
+    // NOTE(laith): open connections sit in a list ordered by last activity so reaping idle ones
+    // only looks at the front, closed ones sit in a free list through next
+    struct lmp_admiral_connection* prev;
+    struct lmp_admiral_connection* next;
+} lmp_admiral_connection;
+
+// NOTE(laith): with more than one worker every network thread binds the admiral port with
+// SO_REUSEPORT and the kernel spreads connections over them. core is -1 to leave the thread unpinned.
+// the arena is made before the thread starts, so running out of memory stops admiral at startup
 typedef struct {
     lmp_admiral_queue* queue;
+    u32 worker;
+    s32 core;
+    u8 reusePort;
+    mem_arena* arena;
 } lmp_admiral_network_args;
 
 typedef struct {
     lmp_admiral_queue* queue;
 } lmp_admiral_admiral_args;
 
-void lmp_admiral_queue_init(lmp_admiral_queue* queue, u8 capacity);
+// NOTE(laith): capacity is rounded up to a power of two. spillPath is NULL to reject messages once
+// the queue is full, otherwise the file is created or emptied
+s8 lmp_admiral_queue_init(lmp_admiral_queue* queue, u32 capacity, const char* spillPath);
+void lmp_admiral_queue_destroy(lmp_admiral_queue* queue);
 s8 lmp_admiral_queue_enqueue(lmp_admiral_queue* queue, const lmp_admiral_message* message);
 lmp_admiral_message* lmp_admiral_queue_dequeue(lmp_admiral_queue* queue);
+// NOTE(laith): timeoutMs is -1 to wait for as long as it takes, returns NULL once it runs out
+lmp_admiral_message* lmp_admiral_queue_dequeue_wait(lmp_admiral_queue* queue, s32 timeoutMs);
+void lmp_admiral_queue_release(lmp_admiral_queue* queue, lmp_admiral_message* message);
+// NOTE(laith): for a consumer with its own event loop. returns 1 when there is something to
+// dequeue or an aborted stream to drop already, otherwise 0 and the next enqueue or abort makes
+// waitFd readable. drain it once it is
+s8 lmp_admiral_queue_park(lmp_admiral_queue* queue);
+void lmp_admiral_queue_drain(lmp_admiral_queue* queue);
+// NOTE(laith): for a network thread that stops taking fragments of a stream partway, so the ones it
+// already queued are dropped instead of going out as a truncated stream
+void lmp_admiral_queue_abort_stream(lmp_admiral_queue* queue, u8 senderId, u16 streamId);
 
-s8 lmp_admiral_add_packet_to_queue(lmp_admiral_queue* queue, lmp_packet* packet, char* endpoint);
+void lmp_admiral_scheduler_init(lmp_admiral_scheduler* scheduler, lmp_admiral_queue* queue);
+void lmp_admiral_scheduler_push(lmp_admiral_scheduler* scheduler, lmp_admiral_message* message, u64 now);
+// NOTE(laith): replays what it can from the log, pushes everything waiting in the queue, then drops
+// the streams that were aborted or went idle. returns 1 when the log has more to replay right away
+s8 lmp_admiral_scheduler_fill(lmp_admiral_scheduler* scheduler, u64 now);
+// NOTE(laith): returns the message whose turn it is without taking it off its lane, NULL when
+// every lane is empty or sitting out. it and the fragments after it stay at the front until
+// lmp_admiral_scheduler_done, or lmp_admiral_scheduler_defer puts its destination on hold
+lmp_admiral_message* lmp_admiral_scheduler_next(lmp_admiral_scheduler* scheduler, u64 now);
+void lmp_admiral_scheduler_done(lmp_admiral_scheduler* scheduler, lmp_admiral_message* message);
+void lmp_admiral_scheduler_defer(lmp_admiral_scheduler* scheduler, u8 destination, u64 now);
+// NOTE(laith): how long until a lane has something to send or a held stream times out, 0 when a
+// lane can send now and -1 when there is nothing to wait for
+s32 lmp_admiral_scheduler_timeout(const lmp_admiral_scheduler* scheduler, u64 now);
+u64 lmp_admiral_scheduler_pending(const lmp_admiral_scheduler* scheduler);
+
+// NOTE(laith): opens or creates the log in directory and attaches it to queue. returns how many
+// undelivered messages it holds, which lmp_admiral_wal_replay puts back into the queue, or -1
+s64 lmp_admiral_wal_open(lmp_admiral_wal* wal, const char* directory, lmp_admiral_queue* queue);
+// NOTE(laith): sets the message's walRecord. returns 1 when the caller enqueues the message, 0
+// when it waits in the log for replay to get to it and -1 when it could not be logged
+s8 lmp_admiral_wal_append(lmp_admiral_wal* wal, lmp_admiral_message* message);
+void lmp_admiral_wal_complete(lmp_admiral_wal* wal, u64 record);
+// NOTE(laith): moves up to ADMIRAL_WAL_REPLAY_BATCH logged messages into the queue, only ever from
+// the thread that consumes it. returns 1 when there is more it can do right away
+s8 lmp_admiral_wal_replay(lmp_admiral_wal* wal, lmp_admiral_queue* queue);
+
+s8 lmp_admiral_add_packet_to_queue(lmp_admiral_queue* queue, lmp_packet* packet, const lmp_admiral_registry_entry* endpoint);
 void lmp_admiral_invalidate_packet(lmp_packet* packet);
 void lmp_admiral_sanitize_message(lmp_admiral_message* message);
+s32 lmp_admiral_connect_to_endpoint(u8 id);
+s8 lmp_admiral_forward_message(u32 fd, const lmp_admiral_message* message);
+s8 lmp_admiral_read_fragment(const lmp_packet* packet, lmp_fragment* fragment);
+
+s8 lmp_admiral_registry_load(const char* path);
+const lmp_admiral_registry_entry* lmp_admiral_map_connection_to_endpoint(u32 fd);
+const lmp_admiral_registry_entry* lmp_admiral_map_peer_to_endpoint(u32 fd);
+const lmp_admiral_registry_entry* lmp_admiral_map_address_to_endpoint(const struct sockaddr* address, socklen_t length);
+const lmp_admiral_registry_entry* lmp_admiral_map_id_to_endpoint(u8 id);
 
-char* lmp_admiral_map_client_to_endpoint(char* client);
-char* lmp_admiral_map_id_to_endpoint(u8 id);
+// ===============================================================
+// Client
+// ===============================================================
+
+// NOTE(laith): admiral knows who a client is by the user it runs as or the port it connects from,
+// so a service gets one connection per identity and every thread in it shares that connection. it
+// is opened on the first send, kept alive with a PING once it has been quiet for
+// LMP_CLIENT_KEEPALIVE_SECONDS, and opened again after a failure once the backoff has passed
+#define LMP_CLIENT_KEEPALIVE_SECONDS 30
+#define LMP_CLIENT_REPLY_TIMEOUT_SECONDS 5
+#define LMP_CLIENT_BACKOFF_MIN_MS 250
+#define LMP_CLIENT_BACKOFF_MAX_MS 30000
+
+// NOTE(laith): how a service reaches admiral is picked with LMP_TRANSPORT in its environment. "unix"
+// is the default and goes over admiral's unix socket when there is one, "shm" goes on from there
+// into shared memory, and both fall back to "tcp" when they can not be used. "udp" sends every
+// packet as a datagram with no session and no replies, so anything lost stays lost
+#define LMP_CLIENT_TRANSPORT_ENV "LMP_TRANSPORT"
+
+typedef enum {
+    LMP_CLIENT_TRANSPORT_TCP,
+    LMP_CLIENT_TRANSPORT_UNIX,
+    LMP_CLIENT_TRANSPORT_SHM,
+    LMP_CLIENT_TRANSPORT_UDP
+} lmp_client_transport;
 
 #endif // LIBLMP_H
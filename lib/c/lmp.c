@@ -16,9 +16,64 @@
 
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "lt_base.h"
 #include "lmp.h"
 
+// NOTE(laith): these tables are the single source of truth for what a valid header looks like.
+// a new version, type or argument only needs an entry here
+typedef struct {
+    u8 header_size;
+    u8 length_prefixed;
+} lmp_version_rule;
+
+// NOTE(laith): a version with no header size is not a valid version
+static const lmp_version_rule lmp_version_table[256] = {
+    [LMP_VERSION_1] = {LMP_PACKET_HEADER_SIZE, 0},
+    [LMP_VERSION_2] = {LMP_PACKET_HEADER_SIZE, 0},
+    [LMP_VERSION_3] = {LMP_PACKET_V3_HEADER_SIZE, 1},
+};
+
+#define LMP_ARG_BIT(arg) ((u64)1 << (arg))
+
+typedef struct {
+    u64 args;
+    u8 empty_payload;
+} lmp_type_rule;
+
+// NOTE(laith): a type with no argument bits set is not a valid type
+static const lmp_type_rule lmp_type_table[256] = {
+    [LMP_TYPE_INIT] = {
+        LMP_ARG_BIT(LMP_ARG_INIT_INIT) | LMP_ARG_BIT(LMP_ARG_INIT_ACCEPT) | LMP_ARG_BIT(LMP_ARG_INIT_SHM),
+        1
+    },
+    [LMP_TYPE_PING] = {
+        LMP_ARG_BIT(LMP_ARG_PING),
+        0
+    },
+    [LMP_TYPE_SEND] = {
+        LMP_ARG_BIT(LMP_ARG_SEND) | LMP_ARG_BIT(LMP_ARG_SEND_FRAGMENT),
+        0
+    },
+    [LMP_TYPE_TERM] = {
+        LMP_ARG_BIT(LMP_ARG_TERM_CLEAN) | LMP_ARG_BIT(LMP_ARG_TERM_BUSY),
+        0
+    },
+    [LMP_TYPE_INVALID] = {
+        LMP_ARG_BIT(LMP_ARG_INVALID_VERSION) | LMP_ARG_BIT(LMP_ARG_INVALID_TYPE)
+        | LMP_ARG_BIT(LMP_ARG_INVALID_MESSAGE) | LMP_ARG_BIT(LMP_ARG_INVALID_ARGUMENT)
+        | LMP_ARG_BIT(LMP_ARG_INVALID_FLAGS) | LMP_ARG_BIT(LMP_ARG_INVALID_PAYLOAD),
+        1
+    },
+};
+
 void lmp_packet_init(lmp_packet* packet) {
     packet->version = 0;
     packet->type = 0;
@@ -34,98 +89,154 @@ void lmp_result_init(lmp_result* result) {
     result->error = LMP_ERR_NONE;
 }
 
-void lmp_packet_serialize(u8* buffer, size_t size, const lmp_packet* packet, lmp_result* result) {
-    if (!buffer || !packet || !result) {
-        result->error = LMP_ERR_BAD_INPUT;
-        return;
-    }
+// NOTE(laith): every check is computed up front and resolved with selects so a stream of mixed
+// good and bad headers does not cost a branch mispredict per field
+lmp_error lmp_packet_validate(lmp_version version, lmp_type type, lmp_arg arg) {
+    u64 args = lmp_type_table[type].args;
 
-    lmp_result_init(result);
+    u32 bad_version = lmp_version_table[version].header_size == 0;
+    u32 bad_type = args == 0;
+    u32 bad_arg = (arg >= 64) | !((args >> (arg & 63)) & 1);
+
+    lmp_error error = bad_arg ? LMP_ERR_BAD_ARG : LMP_ERR_NONE;
+    error = bad_type ? LMP_ERR_BAD_TYPE : error;
+    error = bad_version ? LMP_ERR_BAD_VERSION : error;
+
+    return error;
+}
+
+size_t lmp_packet_header_size(lmp_version version) {
+    return lmp_version_table[version].header_size;
+}
+
+static const u8 lmp_packet_terminate = LMP_PACKET_TERMINATE;
+
+static void lmp_packet_write_header(u8* buffer, const lmp_packet* packet) {
+    buffer[0] = packet->version;
+    buffer[1] = packet->type;
+    buffer[2] = packet->arg;
+    buffer[3] = packet->flags;
 
+    if (lmp_version_table[packet->version].length_prefixed) {
+        buffer[4] = (u8)(packet->payload_length >> 8);
+        buffer[5] = (u8)(packet->payload_length & 0xFF);
+    }
+}
+
+// NOTE(laith): shared by both serializers, returns the total size of the packet on the wire
+static size_t lmp_packet_serialize_check(const lmp_packet* packet, lmp_result* result) {
     if (!packet->payload || packet->payload_length < 1) {
         result->error = LMP_ERR_BAD_PAYLOAD;
-        return;
+        return 0;
     }
 
-    s32 version = 0;
-    for (size_t i = 0; i < ARR_LENGTH(lmp_versions); i++) {
-        if (packet->version == lmp_versions[i]) {
-            version = lmp_versions[i];
-            break;
+    lmp_error error = lmp_packet_validate(packet->version, packet->type, packet->arg);
+    if (error != LMP_ERR_NONE) {
+        result->error = error;
+        return 0;
+    }
+
+    if (lmp_type_table[packet->type].empty_payload) {
+        if (!(packet->payload_length == 1 && packet->payload[0] == LMP_PAYLOAD_EMPTY)) {
+            result->error = LMP_ERR_BAD_PAYLOAD;
+            return 0;
         }
     }
 
-    if (!version) {
-        result->error = LMP_ERR_BAD_VERSION;
-        return;
+    // NOTE(laith): the same rule deserialize holds a one byte payload to, so nothing goes out that
+    // the other side turns away
+    if (!lmp_version_table[packet->version].length_prefixed && packet->payload_length == 1
+        && packet->payload[0] != LMP_PAYLOAD_EMPTY) {
+        result->error = LMP_ERR_BAD_PAYLOAD;
+        return 0;
     }
 
-    if (packet->type < LMP_TYPE_INIT || packet->type > LMP_TYPE_INVALID) {
-        result->error = LMP_ERR_BAD_TYPE;
-        return;
+    size_t total_size = lmp_packet_header_size(packet->version) + packet->payload_length + 1;
+
+    if (total_size < LMP_PACKET_MIN_SIZE || total_size > LMP_PACKET_MAX_SIZE) {
+        result->error = LMP_ERR_BAD_SIZE;
+        return 0;
     }
 
-    switch (packet->type) {
-        case LMP_TYPE_INIT:
-            if (packet->arg < LMP_ARG_INIT_INIT || packet->arg > LMP_ARG_INIT_ACCEPT) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_PING:
-            if (packet->arg != LMP_ARG_PING) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_SEND:
-            if (packet->arg != LMP_ARG_SEND) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_TERM:
-            if (packet->arg < LMP_ARG_TERM_CLEAN || packet->arg > LMP_ARG_TERM_BUSY) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_INVALID:
-            if (packet->arg < LMP_ARG_INVALID_VERSION || packet->arg > LMP_ARG_INVALID_PAYLOAD) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
+    // NOTE(laith): before version 3 the terminate byte is the frame boundary, so it can not show
+    // up inside the payload or the receiver would cut the packet short
+    if (!lmp_version_table[packet->version].length_prefixed
+        && lmp_packet_find_terminate(packet->payload, packet->payload_length) != packet->payload_length) {
+        result->error = LMP_ERR_BAD_PAYLOAD;
+        return 0;
     }
 
-    if ((packet->type == LMP_TYPE_INIT || packet->type == LMP_TYPE_INVALID)) {
-        if (!(packet->payload_length == 1 && packet->payload[0] == LMP_PAYLOAD_EMPTY)) {
-            result->error = LMP_ERR_BAD_PAYLOAD;
-            return;
-        }
+    return total_size;
+}
+
+void lmp_packet_serialize(u8* buffer, size_t size, const lmp_packet* packet, lmp_result* result) {
+    if (!buffer || !packet || !result) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return;
     }
 
-    size_t total_size = LMP_PACKET_HEADER_SIZE + packet->payload_length + 1;
+    lmp_result_init(result);
+
+    size_t total_size = lmp_packet_serialize_check(packet, result);
+    if (result->error != LMP_ERR_NONE) {
+        return;
+    }
 
-    if (total_size < LMP_PACKET_MIN_SIZE || total_size > LMP_PACKET_MAX_SIZE
-        || size < total_size) {
+    if (size < total_size) {
         result->error = LMP_ERR_BAD_SIZE;
         return;
     }
 
-    buffer[0] = version;
-    buffer[1] = packet->type;
-    buffer[2] = packet->arg;
-    buffer[3] = packet->flags;
+    size_t header_size = lmp_packet_header_size(packet->version);
+
+    lmp_packet_write_header(buffer, packet);
 
-    memcpy(buffer + LMP_PACKET_HEADER_SIZE, packet->payload, packet->payload_length);
+    memcpy(buffer + header_size, packet->payload, packet->payload_length);
 
-    buffer[LMP_PACKET_HEADER_SIZE + packet->payload_length] = LMP_PACKET_TERMINATE;
+    buffer[header_size + packet->payload_length] = LMP_PACKET_TERMINATE;
 
     result->size = total_size;
     result->error = LMP_ERR_NONE;
 }
 
+void lmp_packet_serialize_header(u8* header, const lmp_packet* packet, lmp_result* result) {
+    if (!header || !packet || !result) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return;
+    }
+
+    lmp_result_init(result);
+
+    size_t total_size = lmp_packet_serialize_check(packet, result);
+    if (result->error != LMP_ERR_NONE) {
+        return;
+    }
+
+    lmp_packet_write_header(header, packet);
+
+    result->size = total_size;
+    result->error = LMP_ERR_NONE;
+}
+
+void lmp_packet_serialize_iov(u8* header, struct iovec* iov, const lmp_packet* packet, lmp_result* result) {
+    if (!iov) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return;
+    }
+
+    lmp_packet_serialize_header(header, packet, result);
+    if (result->error != LMP_ERR_NONE) {
+        return;
+    }
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = lmp_packet_header_size(packet->version);
+    iov[1].iov_base = (void*)packet->payload;
+    iov[1].iov_len = packet->payload_length;
+    iov[2].iov_base = (void*)&lmp_packet_terminate;
+    iov[2].iov_len = 1;
+}
+
 void lmp_packet_deserialize(const u8* buffer, size_t size, lmp_packet* packet, lmp_result* result) {
     if (!buffer || !packet || !result) {
         result->error = LMP_ERR_BAD_INPUT;
@@ -139,64 +250,26 @@ void lmp_packet_deserialize(const u8* buffer, size_t size, lmp_packet* packet, l
         return;
     }
 
-    s32 version = 0;
-    for (size_t i = 0; i < ARR_LENGTH(lmp_versions); i++) {
-        if (buffer[0] == lmp_versions[i]) {
-            version = buffer[0];
-            break;
-        }
-    }
-
-    if (version == 0) {
-        result->error = LMP_ERR_BAD_VERSION;
+    lmp_error error = lmp_packet_validate(buffer[0], buffer[1], buffer[2]);
+    if (error != LMP_ERR_NONE) {
+        result->error = error;
         return;
     }
 
-    if (buffer[1] < LMP_TYPE_INIT || buffer[1] > LMP_TYPE_INVALID) {
-        result->error = LMP_ERR_BAD_TYPE;
-        return;
-    }
+    size_t header_size = lmp_packet_header_size(buffer[0]);
 
-    switch (buffer[1]) {
-        case LMP_TYPE_INIT:
-            if (buffer[2] < LMP_ARG_INIT_INIT || buffer[2] > LMP_ARG_INIT_ACCEPT) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_PING:
-            if (buffer[2] != LMP_ARG_PING) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_SEND:
-            if (buffer[2] != LMP_ARG_SEND) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_TERM:
-            if (buffer[2] < LMP_ARG_TERM_CLEAN || buffer[2] > LMP_ARG_TERM_BUSY) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
-        case LMP_TYPE_INVALID:
-            if (buffer[2] < LMP_ARG_INVALID_VERSION || buffer[2] > LMP_ARG_INVALID_PAYLOAD) {
-                result->error = LMP_ERR_BAD_ARG;
-                return;
-            }
-            break;
+    if (size < header_size + 1) {
+        result->error = LMP_ERR_BAD_SIZE;
+        return;
     }
 
-    packet->version = version;
+    packet->version = buffer[0];
     packet->type = buffer[1];
     packet->arg = buffer[2];
     packet->flags = buffer[3];
 
-    if ((buffer[1] == LMP_TYPE_INVALID || buffer[1] == LMP_TYPE_INIT)
-        && buffer[LMP_PACKET_HEADER_SIZE] != LMP_PAYLOAD_EMPTY) {
+    if (lmp_type_table[buffer[1]].empty_payload
+        && buffer[header_size] != LMP_PAYLOAD_EMPTY) {
         result->error = LMP_ERR_BAD_PAYLOAD;
         return;
     }
@@ -206,32 +279,224 @@ void lmp_packet_deserialize(const u8* buffer, size_t size, lmp_packet* packet, l
         return;
     }
 
-    if (size < LMP_PACKET_HEADER_SIZE + 1) {
+    size_t payload_length = size - header_size - 1;
+
+    if (lmp_version_table[buffer[0]].length_prefixed
+        && (((size_t)buffer[4] << 8) | buffer[5]) != payload_length) {
         result->error = LMP_ERR_BAD_SIZE;
         return;
     }
 
-    size_t payload_length = size - LMP_PACKET_HEADER_SIZE - 1;
-
     if (payload_length < 1) {
         result->error = LMP_ERR_BAD_PAYLOAD;
         return;
     }
 
-	if ((packet->type == LMP_TYPE_INIT || packet->type == LMP_TYPE_INVALID)
-        && payload_length != 1) {
+	if (lmp_type_table[packet->type].empty_payload && payload_length != 1) {
 	    result->error = LMP_ERR_BAD_PAYLOAD;
 	    return;
 	}
 
-	if (payload_length == 1 && buffer[LMP_PACKET_HEADER_SIZE] != LMP_PAYLOAD_EMPTY) {
-	    result->error = LMP_ERR_BAD_PAYLOAD;
-	    return;
-	}
+    // NOTE(laith): before version 3 a one byte payload is always the empty byte. with a length
+    // prefix it can be any byte, only the types that carry no payload still insist on it
+    if (!lmp_version_table[buffer[0]].length_prefixed && payload_length == 1
+        && buffer[header_size] != LMP_PAYLOAD_EMPTY) {
+        result->error = LMP_ERR_BAD_PAYLOAD;
+        return;
+    }
 
-    packet->payload = buffer + LMP_PACKET_HEADER_SIZE;
+    packet->payload = buffer + header_size;
     packet->payload_length = payload_length;
 
     result->size = size;
     result->error = LMP_ERR_NONE;
 }
+
+void lmp_packet_strip(lmp_packet* packet, size_t size, lmp_result* result) {
+    if (!packet || !result) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return;
+    }
+
+    lmp_result_init(result);
+
+    if (!packet->payload || size >= packet->payload_length) {
+        result->error = LMP_ERR_BAD_PAYLOAD;
+        return;
+    }
+
+    packet->payload += size;
+    packet->payload_length -= size;
+
+    result->size = packet->payload_length;
+}
+
+size_t lmp_packet_find_terminate(const u8* buffer, size_t size) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i terminate = _mm256_set1_epi8(LMP_PACKET_TERMINATE);
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(buffer + i));
+        u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, terminate));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i terminate = _mm_set1_epi8(LMP_PACKET_TERMINATE);
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(buffer + i));
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, terminate));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    // NOTE(laith): neon has no movemask, narrowing the compare gives 4 bits per byte instead
+    const uint8x16_t terminate = vdupq_n_u8(LMP_PACKET_TERMINATE);
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t matches = vceqq_u8(vld1q_u8(buffer + i), terminate);
+        uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+        u64 mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+        if (mask) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        if (buffer[i] == LMP_PACKET_TERMINATE) {
+            return i;
+        }
+    }
+
+    return size;
+}
+
+size_t lmp_packet_frame(const u8* buffer, size_t size, lmp_result* result) {
+    lmp_result_init(result);
+
+    if (size == 0) {
+        result->error = LMP_ERR_INCOMPLETE;
+        return 0;
+    }
+
+    if (lmp_version_table[buffer[0]].length_prefixed) {
+        if (size < LMP_PACKET_V3_HEADER_SIZE) {
+            result->error = LMP_ERR_INCOMPLETE;
+            return 0;
+        }
+
+        size_t frame_size = LMP_PACKET_V3_HEADER_SIZE + (((size_t)buffer[4] << 8) | buffer[5]) + 1;
+        if (frame_size > LMP_PACKET_MAX_SIZE) {
+            result->error = LMP_ERR_BAD_SIZE;
+            return 0;
+        }
+
+        if (size < frame_size) {
+            result->error = LMP_ERR_INCOMPLETE;
+            result->size = frame_size;
+            return 0;
+        }
+
+        result->size = frame_size;
+        return frame_size;
+    }
+
+    size_t window = MIN(size, (size_t)LMP_PACKET_MAX_SIZE);
+    size_t end = lmp_packet_find_terminate(buffer, window);
+
+    if (end == window) {
+        // NOTE(laith): no terminator within a max sized packet means the stream is garbage,
+        // otherwise it is just a partial packet that the caller has to read more of
+        result->error = size >= LMP_PACKET_MAX_SIZE ? LMP_ERR_BAD_SIZE : LMP_ERR_INCOMPLETE;
+        return 0;
+    }
+
+    result->size = end + 1;
+    return end + 1;
+}
+
+size_t lmp_packet_deserialize_batch(const u8* buffer, size_t size, lmp_packet* packets, size_t max, lmp_result* result) {
+    if (!buffer || !packets || !result) {
+        if (result) {
+            result->error = LMP_ERR_BAD_INPUT;
+        }
+        return 0;
+    }
+
+    lmp_result_init(result);
+
+    size_t count = 0;
+    size_t offset = 0;
+
+    while (count < max && offset < size) {
+        lmp_result frame;
+        lmp_result_init(&frame);
+
+        size_t frame_size = lmp_packet_frame(buffer + offset, size - offset, &frame);
+        if (frame.error == LMP_ERR_INCOMPLETE) {
+            break;
+        }
+
+        if (frame.error == LMP_ERR_NONE) {
+            lmp_packet_deserialize(buffer + offset, frame_size, &packets[count], &frame);
+        }
+
+        if (frame.error != LMP_ERR_NONE) {
+            result->error = frame.error;
+            break;
+        }
+
+        count++;
+        offset += frame_size;
+    }
+
+    result->size = offset;
+    return count;
+}
+
+void lmp_fragment_serialize_header(u8* header, const lmp_fragment* fragment) {
+    header[0] = (u8)(fragment->stream_id >> 8);
+    header[1] = (u8)(fragment->stream_id & 0xFF);
+
+    for (u32 i = 0; i < 4; i++) {
+        header[2 + i] = (u8)(fragment->offset >> (24 - 8 * i));
+        header[6 + i] = (u8)(fragment->total >> (24 - 8 * i));
+    }
+}
+
+void lmp_fragment_deserialize(const u8* payload, size_t size, lmp_fragment* fragment, lmp_result* result) {
+    if (!payload || !fragment || !result) {
+        result->error = LMP_ERR_BAD_INPUT;
+        return;
+    }
+
+    lmp_result_init(result);
+
+    if (size < LMP_FRAGMENT_HEADER_SIZE + 1) {
+        result->error = LMP_ERR_BAD_PAYLOAD;
+        return;
+    }
+
+    fragment->stream_id = (u16)((payload[0] << 8) | payload[1]);
+    fragment->offset = 0;
+    fragment->total = 0;
+
+    for (u32 i = 0; i < 4; i++) {
+        fragment->offset = (fragment->offset << 8) | payload[2 + i];
+        fragment->total = (fragment->total << 8) | payload[6 + i];
+    }
+
+    fragment->data = payload + LMP_FRAGMENT_HEADER_SIZE;
+    fragment->data_length = size - LMP_FRAGMENT_HEADER_SIZE;
+
+    if (fragment->offset > fragment->total
+        || fragment->data_length > fragment->total - fragment->offset) {
+        result->error = LMP_ERR_BAD_PAYLOAD;
+        return;
+    }
+
+    result->size = size;
+}
@@ -19,6 +19,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "lt_base.h"
 
@@ -28,7 +29,11 @@ typedef u8 lmp_arg;
 typedef u8 lmp_flag;
 
 /* [0] Version */
-static const lmp_version lmp_versions[] = {1, 2};
+#define LMP_VERSION_1 0x01
+#define LMP_VERSION_2 0x02
+#define LMP_VERSION_3 0x03 // length prefixed, payload may contain any byte
+
+static const lmp_version lmp_versions[] = {LMP_VERSION_1, LMP_VERSION_2, LMP_VERSION_3};
 
 /* [1] Type */
 #define LMP_TYPE_INIT 0x01
@@ -40,8 +45,10 @@ static const lmp_version lmp_versions[] = {1, 2};
 /* [2] Argument */
 #define LMP_ARG_INIT_INIT 0x01
 #define LMP_ARG_INIT_ACCEPT 0x02
+#define LMP_ARG_INIT_SHM 0x03 // INIT asking to carry the session over shared memory
 #define LMP_ARG_PING 0x00
 #define LMP_ARG_SEND 0x00
+#define LMP_ARG_SEND_FRAGMENT 0x01
 #define LMP_ARG_TERM_CLEAN 0x01
 #define LMP_ARG_TERM_BUSY 0x02
 #define LMP_ARG_INVALID_VERSION 0x01
@@ -55,16 +62,26 @@ static const lmp_version lmp_versions[] = {1, 2};
 #define LMP_FLAGS_NONE 0
 #define LMP_FLAGS_LOG (1 << 0)
 #define LMP_FLAGS_INCOGNITO (1 << 1)
+#define LMP_FLAGS_PRIORITY (1 << 2) // admiral forwards it ahead of anything without the flag
 
 /* [4] Payload */
 #define LMP_PAYLOAD_EMPTY 0x00
 
 /* Packet */
 #define LMP_PACKET_HEADER_SIZE 0x04 // 4
+#define LMP_PACKET_V3_HEADER_SIZE 0x06 // 6, [version][type][arg][flags][length hi][length lo]
+#define LMP_PACKET_HEADER_MAX_SIZE LMP_PACKET_V3_HEADER_SIZE
 #define LMP_PACKET_MAX_SIZE 0x5DC // 1500
 #define LMP_PACKET_MIN_SIZE 0x05 // 5
 #define LMP_PACKET_TERMINATE 0x7F
 #define LMP_PACKET_PAYLOAD_MAX_SIZE 0x5D7 // 1495
+#define LMP_PACKET_V3_PAYLOAD_MAX_SIZE 0x5D5 // 1493
+#define LMP_PACKET_IOV_COUNT 3 // header, payload, terminate
+
+/* Fragment */
+// NOTE(laith): a SEND_FRAGMENT payload starts with this header, after any routing bytes the
+// receiver strips first. fragments are only sent as version 3 since the header is binary
+#define LMP_FRAGMENT_HEADER_SIZE 0x0A // 10, [stream id:2][offset:4][total:4]
 
 typedef enum {
     LMP_ERR_NONE,
@@ -74,7 +91,10 @@ typedef enum {
     LMP_ERR_BAD_ARG,
     LMP_ERR_BAD_PAYLOAD,
     LMP_ERR_BAD_TERMINATE,
-    LMP_ERR_BAD_INPUT
+    LMP_ERR_BAD_INPUT,
+    LMP_ERR_INCOMPLETE,
+    LMP_ERR_CLOSED,
+    LMP_ERR_TIMEOUT
 } lmp_error;
 
 typedef struct {
@@ -92,9 +112,47 @@ typedef struct {
     lmp_error error;
 } lmp_result;
 
+typedef struct {
+    u16 stream_id;
+    u32 offset;
+    u32 total;
+
+    const u8* data;
+    size_t data_length;
+} lmp_fragment;
+
 void lmp_packet_init(lmp_packet* packet);
 void lmp_result_init(lmp_result* result);
+lmp_error lmp_packet_validate(lmp_version version, lmp_type type, lmp_arg arg);
+size_t lmp_packet_header_size(lmp_version version);
 void lmp_packet_serialize(u8* buffer, size_t size, const lmp_packet* packet, lmp_result* result);
 void lmp_packet_deserialize(const u8* buffer, size_t size, lmp_packet* packet, lmp_result* result);
 
+// NOTE(laith): validates the packet and writes only its header, result->size is the size the whole
+// packet will be on the wire. header must hold LMP_PACKET_HEADER_MAX_SIZE bytes
+void lmp_packet_serialize_header(u8* header, const lmp_packet* packet, lmp_result* result);
+
+// NOTE(laith): writes the header into header and points iov at it, the packet payload and the
+// terminate byte, no payload bytes are copied. header must hold LMP_PACKET_HEADER_MAX_SIZE bytes
+// and iov LMP_PACKET_IOV_COUNT entries, both have to outlive the write
+void lmp_packet_serialize_iov(u8* header, struct iovec* iov, const lmp_packet* packet, lmp_result* result);
+
+// NOTE(laith): returns the index of the first LMP_PACKET_TERMINATE byte, or size if there is none
+size_t lmp_packet_find_terminate(const u8* buffer, size_t size);
+
+// NOTE(laith): returns the size of the packet at the start of buffer. version 3 packets are framed
+// by their length, older versions by the first terminate byte. if the packet is not all there yet
+// this returns 0 with LMP_ERR_INCOMPLETE and result->size set to the full size when it is known
+size_t lmp_packet_frame(const u8* buffer, size_t size, lmp_result* result);
+
+// NOTE(laith): frames and deserializes every complete packet in buffer, up to max. packets are views
+// into buffer. result->size is the number of bytes consumed, a trailing partial packet is not consumed
+size_t lmp_packet_deserialize_batch(const u8* buffer, size_t size, lmp_packet* packets, size_t max, lmp_result* result);
+
+// NOTE(laith): drops size bytes off the front of the payload by moving the view, nothing is copied
+void lmp_packet_strip(lmp_packet* packet, size_t size, lmp_result* result);
+
+void lmp_fragment_serialize_header(u8* header, const lmp_fragment* fragment);
+void lmp_fragment_deserialize(const u8* payload, size_t size, lmp_fragment* fragment, lmp_result* result);
+
 #endif // LMP_H
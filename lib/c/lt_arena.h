@@ -45,7 +45,9 @@ void arena_pop(mem_arena* arena, u64 mark);
 
 mem_arena* arena_create(u64 capacity) {
     mem_arena* arena = (mem_arena*)malloc(capacity);
-    // TODO(laith): null check here?
+    if (arena == NULL) {
+        return NULL;
+    }
 
     arena->capacity = capacity;
     // points the starting position to the end of the arena struct in address space
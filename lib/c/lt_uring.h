@@ -0,0 +1,369 @@
+/*  lt_uring.h - Single file library for a small io_uring wrapper over the raw syscalls
+    Copyright (C) 2026 splatte.dev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef LT_URING_H
+#define LT_URING_H
+
+#include "lt_base.h"
+
+#if OS_LINUX
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/* API Definitions */
+
+// NOTE(laith): only the parts of io_uring the services use, so there is no liburing to install on
+// the boxes. one ring belongs to one thread
+typedef struct {
+    s32 fd;
+    u32 features;
+
+    u32* sq_head;
+    u32* sq_tail;
+    u32* sq_array;
+    u32 sq_mask;
+    u32 sq_entries;
+    u32 sqe_tail;
+    struct io_uring_sqe* sqes;
+
+    u32* cq_head;
+    u32* cq_tail;
+    u32 cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+
+// NOTE(laith): a provided buffer ring, the kernel picks a buffer out of it for every completion so
+// nothing has to be set aside for a socket before it has data
+typedef struct {
+    struct io_uring_buf_ring* ring;
+    u8* buffers;
+    u32 entries;
+    u32 buffer_size;
+    u16 group;
+} uring_buf_ring;
+
+s32 uring_init(uring* ring, u32 entries, u32 flags);
+void uring_destroy(uring* ring);
+struct io_uring_sqe* uring_get_sqe(uring* ring);
+s32 uring_submit_and_wait(uring* ring, u32 wait);
+struct io_uring_cqe* uring_peek_cqe(uring* ring);
+void uring_cqe_seen(uring* ring);
+s32 uring_register_buffers(uring* ring, const struct iovec* iov, u32 count);
+
+s32 uring_buf_ring_init(uring* ring, uring_buf_ring* buffers, u16 group, u32 entries, u32 buffer_size);
+void uring_buf_ring_destroy(uring* ring, uring_buf_ring* buffers);
+u8* uring_buf_ring_buffer(uring_buf_ring* buffers, u16 id);
+void uring_buf_ring_recycle(uring_buf_ring* buffers, u16 id);
+
+void uring_prep_accept_multishot(struct io_uring_sqe* sqe, s32 fd, u32 flags, u64 user_data);
+void uring_prep_recv_multishot(struct io_uring_sqe* sqe, s32 fd, u16 group, u64 user_data);
+void uring_prep_write_fixed(struct io_uring_sqe* sqe, s32 fd, const void* buf, u32 length, u16 index, u64 user_data);
+void uring_prep_send(struct io_uring_sqe* sqe, s32 fd, const void* buf, u32 length, u32 flags, u64 user_data);
+void uring_prep_timeout(struct io_uring_sqe* sqe, struct __kernel_timespec* ts, u64 user_data);
+void uring_prep_read(struct io_uring_sqe* sqe, s32 fd, void* buf, u32 length, u64 user_data);
+void uring_prep_poll_multishot(struct io_uring_sqe* sqe, s32 fd, u32 events, u64 user_data);
+
+/* API Implementations */
+
+#if defined(LT_URING_IMPLEMENTATION)
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// NOTE(laith): the kernel reads the tails and writes the heads from its side, so those go through
+// acquire and release, everything else in the rings is only touched by the owning thread
+#define URING_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define URING_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static s32 uring_enter(s32 fd, u32 submit, u32 wait, u32 flags) {
+    return (s32)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+// NOTE(laith): returns -errno so callers can tell an old kernel (EINVAL, ENOSYS) from a real failure
+s32 uring_init(uring* ring, u32 entries, u32 flags) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    params.flags = flags;
+
+    s32 fd = (s32)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    ring->fd = fd;
+    ring->features = params.features;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        s32 error = -errno;
+        close(fd);
+        return error;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            s32 error = -errno;
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(fd);
+            return error;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        s32 error = -errno;
+        if (ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(fd);
+        return error;
+    }
+
+    u8* sq = (u8*)ring->sq_ring;
+    ring->sq_head = (u32*)(sq + params.sq_off.head);
+    ring->sq_tail = (u32*)(sq + params.sq_off.tail);
+    ring->sq_array = (u32*)(sq + params.sq_off.array);
+    ring->sq_mask = *(u32*)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    u8* cq = (u8*)ring->cq_ring;
+    ring->cq_head = (u32*)(cq + params.cq_off.head);
+    ring->cq_tail = (u32*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(u32*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // NOTE(laith): the indirection array never changes, slot i always points at sqe i
+    for (u32 i = 0; i < params.sq_entries; i++) {
+        ring->sq_array[i] = i;
+    }
+
+    return 0;
+}
+
+void uring_destroy(uring* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// NOTE(laith): hands out the next free sqe, flushing what is queued when the ring is full. the
+// sqe is zeroed so the prep helpers only fill in what they use
+struct io_uring_sqe* uring_get_sqe(uring* ring) {
+    if (ring->sqe_tail - URING_LOAD_ACQUIRE(ring->sq_head) >= ring->sq_entries) {
+        uring_submit_and_wait(ring, 0);
+        if (ring->sqe_tail - URING_LOAD_ACQUIRE(ring->sq_head) >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+// NOTE(laith): one syscall submits everything queued since the last call and waits for at least
+// wait completions
+s32 uring_submit_and_wait(uring* ring, u32 wait) {
+    u32 submit = ring->sqe_tail - *ring->sq_tail;
+    URING_STORE_RELEASE(ring->sq_tail, ring->sqe_tail);
+
+    for (;;) {
+        s32 r = uring_enter(ring->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+
+        return r < 0 ? -errno : r;
+    }
+}
+
+struct io_uring_cqe* uring_peek_cqe(uring* ring) {
+    u32 head = *ring->cq_head;
+    if (head == URING_LOAD_ACQUIRE(ring->cq_tail)) {
+        return NULL;
+    }
+
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring* ring) {
+    URING_STORE_RELEASE(ring->cq_head, *ring->cq_head + 1);
+}
+
+s32 uring_register_buffers(uring* ring, const struct iovec* iov, u32 count) {
+    s32 r = (s32)syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, count);
+    return r < 0 ? -errno : 0;
+}
+
+// NOTE(laith): entries has to be a power of two, every buffer starts out owned by the kernel
+s32 uring_buf_ring_init(uring* ring, uring_buf_ring* buffers, u16 group, u32 entries, u32 buffer_size) {
+    size_t ringSize = entries * sizeof(struct io_uring_buf);
+
+    void* mapped = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return -errno;
+    }
+
+    u8* data = mmap(NULL, (size_t)entries * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        s32 error = -errno;
+        munmap(mapped, ringSize);
+        return error;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (u64)(uintptr_t)mapped;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        s32 error = -errno;
+        munmap(data, (size_t)entries * buffer_size);
+        munmap(mapped, ringSize);
+        return error;
+    }
+
+    buffers->ring = (struct io_uring_buf_ring*)mapped;
+    buffers->buffers = data;
+    buffers->entries = entries;
+    buffers->buffer_size = buffer_size;
+    buffers->group = group;
+
+    for (u32 i = 0; i < entries; i++) {
+        struct io_uring_buf* buf = &buffers->ring->bufs[i];
+        buf->addr = (u64)(uintptr_t)(data + (size_t)i * buffer_size);
+        buf->len = buffer_size;
+        buf->bid = (u16)i;
+    }
+    URING_STORE_RELEASE(&buffers->ring->tail, (u16)entries);
+
+    return 0;
+}
+
+void uring_buf_ring_destroy(uring* ring, uring_buf_ring* buffers) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = buffers->group;
+
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(buffers->buffers, (size_t)buffers->entries * buffers->buffer_size);
+    munmap(buffers->ring, buffers->entries * sizeof(struct io_uring_buf));
+}
+
+u8* uring_buf_ring_buffer(uring_buf_ring* buffers, u16 id) {
+    return buffers->buffers + (size_t)id * buffers->buffer_size;
+}
+
+// NOTE(laith): gives a buffer the kernel filled back to it once the bytes have been used
+void uring_buf_ring_recycle(uring_buf_ring* buffers, u16 id) {
+    u16 tail = buffers->ring->tail;
+    struct io_uring_buf* buf = &buffers->ring->bufs[tail & (buffers->entries - 1)];
+
+    buf->addr = (u64)(uintptr_t)uring_buf_ring_buffer(buffers, id);
+    buf->len = buffers->buffer_size;
+    buf->bid = id;
+
+    URING_STORE_RELEASE(&buffers->ring->tail, (u16)(tail + 1));
+}
+
+static void uring_prep_rw(struct io_uring_sqe* sqe, u8 op, s32 fd, const void* addr, u32 length, u64 user_data) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (u64)(uintptr_t)addr;
+    sqe->len = length;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe* sqe, s32 fd, u32 flags, u64 user_data) {
+    uring_prep_rw(sqe, IORING_OP_ACCEPT, fd, NULL, 0, user_data);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = flags;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe* sqe, s32 fd, u16 group, u64 user_data) {
+    uring_prep_rw(sqe, IORING_OP_RECV, fd, NULL, 0, user_data);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+}
+
+// NOTE(laith): buf has to sit inside the registered buffer at index, the kernel skips pinning the
+// pages again for every write
+void uring_prep_write_fixed(struct io_uring_sqe* sqe, s32 fd, const void* buf, u32 length, u16 index, u64 user_data) {
+    uring_prep_rw(sqe, IORING_OP_WRITE_FIXED, fd, buf, length, user_data);
+    sqe->off = (u64)-1;
+    sqe->buf_index = index;
+}
+
+void uring_prep_send(struct io_uring_sqe* sqe, s32 fd, const void* buf, u32 length, u32 flags, u64 user_data) {
+    uring_prep_rw(sqe, IORING_OP_SEND, fd, buf, length, user_data);
+    sqe->msg_flags = flags;
+}
+
+void uring_prep_timeout(struct io_uring_sqe* sqe, struct __kernel_timespec* ts, u64 user_data) {
+    uring_prep_rw(sqe, IORING_OP_TIMEOUT, -1, ts, 1, user_data);
+}
+
+// NOTE(laith): reads at the file's current position, which is all there is for eventfds and pipes
+void uring_prep_read(struct io_uring_sqe* sqe, s32 fd, void* buf, u32 length, u64 user_data) {
+    uring_prep_rw(sqe, IORING_OP_READ, fd, buf, length, user_data);
+    sqe->off = (u64)-1;
+}
+
+// NOTE(laith): posts a completion every time fd becomes ready instead of once
+void uring_prep_poll_multishot(struct io_uring_sqe* sqe, s32 fd, u32 events, u64 user_data) {
+    uring_prep_rw(sqe, IORING_OP_POLL_ADD, fd, NULL, IORING_POLL_ADD_MULTI, user_data);
+    sqe->poll32_events = events;
+}
+
+#endif // LT_URING_IMPLEMENTATION
+
+#endif // OS_LINUX
+
+#endif // LT_URING_H
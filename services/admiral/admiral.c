@@ -14,13 +14,24 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <https://www.gnu.org/licenses/>. */
 
+// NOTE(laith): for pthread_setaffinity_np
+#define _GNU_SOURCE
 
 #include <netinet/in.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <pthread.h>
 
@@ -29,165 +40,1569 @@
 #include "../../lib/c/lmp.h"
 #include "../../lib/c/liblmp.h"
 
+#if OS_LINUX
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define LT_URING_IMPLEMENTATION
+#include "../../lib/c/lt_uring.h"
+#endif
+
+// NOTE(laith): everything one network thread owns. connection slots are handed out from the free
+// list and their buffers are pushed onto connectionArena the first time a slot is used, so memory
+// follows the most connections seen at once instead of ADMIRAL_MAX_CONNECTIONS
+typedef struct {
+    lmp_admiral_queue* queue;
+    mem_arena* connectionArena;
+
+    lmp_admiral_connection* connections;
+    lmp_admiral_connection* available;
+    lmp_admiral_connection* oldest;
+    lmp_admiral_connection* newest;
+    s32 socketFd;
+    s32 unixFd;
+    s32 pollFd;
+
+    s32 datagramFd;
+    lmp_net_datagram* datagrams;
+    u64 droppedDatagrams;
+} admiral_network;
+
+static void admiral_idle_unlink(admiral_network* network, lmp_admiral_connection* connection) {
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        network->oldest = connection->next;
+    }
+
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    } else {
+        network->newest = connection->prev;
+    }
+
+    connection->prev = NULL;
+    connection->next = NULL;
+}
+
+static void admiral_idle_push(admiral_network* network, lmp_admiral_connection* connection) {
+    connection->prev = network->newest;
+    connection->next = NULL;
+
+    if (network->newest) {
+        network->newest->next = connection;
+    } else {
+        network->oldest = connection;
+    }
+
+    network->newest = connection;
+}
+
+static void admiral_touch_connection(admiral_network* network, lmp_admiral_connection* connection, time_t now) {
+    connection->lastActive = now;
+
+    if (network->newest != connection) {
+        admiral_idle_unlink(network, connection);
+        admiral_idle_push(network, connection);
+    }
+}
+
+// NOTE(laith): returns -1 when the socket is broken. a shared connection's replies go into its
+// ring instead, where whatever does not fit waits for the service to wake admiral up again
+static s8 admiral_flush_connection(lmp_admiral_connection* connection) {
+    size_t sent = 0;
+
+    if (connection->shared) {
+        sent = lmp_shm_write(&connection->shm, connection->outbox, connection->outboxLength);
+    }
+
+    while (!connection->shared && sent < connection->outboxLength) {
+        ssize_t n = send(connection->fd, connection->outbox + sent, connection->outboxLength - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        if (n <= 0) {
+            return -1;
+        }
+
+        sent += n;
+    }
+
+    memmove(connection->outbox, connection->outbox + sent, connection->outboxLength - sent);
+    connection->outboxLength -= sent;
+    if (sent > 0) {
+        connection->writeStarted = 0;
+    }
+
+    return 1;
+}
+
+// NOTE(laith): a frame's clock starts with its first byte and stops when it is handled, the
+// outbox's starts when it stops draining and stops whenever something goes out
+static void admiral_track_deadlines(lmp_admiral_connection* connection, time_t now) {
+    if (connection->reader.end == connection->reader.start) {
+        connection->frameStarted = 0;
+    } else if (connection->frameStarted == 0) {
+        connection->frameStarted = now;
+    }
+
+    if (connection->outboxLength == 0) {
+        connection->writeStarted = 0;
+    } else if (connection->writeStarted == 0) {
+        connection->writeStarted = now;
+    }
+}
+
+static void admiral_close_connection(admiral_network* network, lmp_admiral_connection* connection, const char* reason) {
+    LMP_LOG_INFO("admiral", "Closing connection from [%s]: %s", connection->endpoint->name, reason);
+
+    // NOTE(laith): the fragments already queued would otherwise go out as a truncated stream
+    if (connection->streaming) {
+        lmp_admiral_queue_abort_stream(network->queue, connection->endpoint->id, connection->streamId);
+        connection->streaming = 0;
+    }
+
+    // NOTE(laith): replies handled just before a TERM still get a chance to go out
+    if (connection->outboxInFlight == 0 && connection->outboxLength > 0) {
+        admiral_flush_connection(connection);
+    }
+
+    // NOTE(laith): the service holds the other end of the eventfd, so closing it here would leave
+    // it in the epoll set. waking it ends a read io_uring still has armed on it
+    if (connection->shared) {
+#if OS_LINUX
+        if (network->pollFd != -1) {
+            epoll_ctl(network->pollFd, EPOLL_CTL_DEL, connection->shm.eventFd, NULL);
+        }
+#endif
+
+        u64 one = 1;
+        if (write(connection->shm.eventFd, &one, sizeof(one)) < 0) {
+            LMP_LOG_WARN("admiral", "Could not release shm wakeups");
+        }
+
+        lmp_shm_destroy(&connection->shm);
+        connection->shared = 0;
+        connection->sharedWatched = 0;
+    }
+
+    // NOTE(laith): closing the fd also takes it out of the epoll set. io_uring holds its own
+    // reference to the socket, the shutdown is what ends a recv it still has armed
+    shutdown(connection->fd, SHUT_RDWR);
+    close(connection->fd);
+    connection->fd = -1;
+    connection->generation++;
+
+    admiral_idle_unlink(network, connection);
+    connection->next = network->available;
+    network->available = connection;
+}
+
+// NOTE(laith): replies pile up in the outbox while a read is handled and go out together after
+// it. a client that never reads its replies fills its outbox and gets dropped
+static s8 admiral_queue_reply(lmp_admiral_connection* connection, const lmp_packet* packet) {
+    lmp_result result;
+    lmp_packet_serialize(connection->outbox + connection->outboxLength,
+                         ADMIRAL_OUTBOX_SIZE - connection->outboxLength, packet, &result);
+
+    // NOTE(laith): out of room, push out what is there now unless io_uring is still writing it
+    if (result.error != LMP_ERR_NONE && connection->outboxInFlight == 0) {
+        if (admiral_flush_connection(connection) == -1) {
+            return -1;
+        }
+
+        lmp_packet_serialize(connection->outbox + connection->outboxLength,
+                             ADMIRAL_OUTBOX_SIZE - connection->outboxLength, packet, &result);
+    }
+
+    if (result.error != LMP_ERR_NONE) {
+        return -1;
+    }
+
+    connection->outboxLength += result.size;
+
+    return 1;
+}
+
+static const u8 emptyPayload[] = {LMP_PAYLOAD_EMPTY};
+
+static s8 admiral_reply(lmp_admiral_connection* connection, lmp_version version, lmp_type type, lmp_arg arg) {
+    lmp_packet sendPacket;
+
+    lmp_packet_init(&sendPacket);
+    sendPacket.version = version;
+    sendPacket.type = type;
+    sendPacket.arg = arg;
+    sendPacket.payload = emptyPayload;
+    sendPacket.payload_length = sizeof(emptyPayload);
+
+    return admiral_queue_reply(connection, &sendPacket);
+}
+
+// NOTE(laith): the fds have to ride on the very next bytes on the socket, so whatever is still in
+// the outbox goes out first. a connection that is not local, or not able to move right now, gets a
+// plain INIT ACCEPT and stays on its socket
+static s8 admiral_share_connection(lmp_admiral_connection* connection, lmp_version version) {
+    if (!connection->local || connection->shared || connection->outboxInFlight > 0) {
+        return admiral_reply(connection, version, LMP_TYPE_INIT, LMP_ARG_INIT_ACCEPT);
+    }
+
+    if (admiral_flush_connection(connection) == -1) {
+        return -1;
+    }
+
+    if (connection->outboxLength > 0 || lmp_shm_create(&connection->shm) != LMP_ERR_NONE) {
+        return admiral_reply(connection, version, LMP_TYPE_INIT, LMP_ARG_INIT_ACCEPT);
+    }
+
+    lmp_packet sendPacket;
+    lmp_result result;
+    u8 buffer[LMP_PACKET_HEADER_MAX_SIZE + 2];
+
+    lmp_packet_init(&sendPacket);
+    sendPacket.version = version;
+    sendPacket.type = LMP_TYPE_INIT;
+    sendPacket.arg = LMP_ARG_INIT_ACCEPT;
+    sendPacket.payload = emptyPayload;
+    sendPacket.payload_length = sizeof(emptyPayload);
+
+    lmp_packet_serialize(buffer, sizeof(buffer), &sendPacket, &result);
+    if (result.error != LMP_ERR_NONE
+        || lmp_net_send_fds(connection->fd, buffer, result.size, connection->shm.fds, LMP_SHM_FD_COUNT) != LMP_ERR_NONE) {
+        lmp_shm_destroy(&connection->shm);
+        return -1;
+    }
+
+    connection->shared = 1;
+    connection->sharedWatched = 0;
+
+    return 1;
+}
+
+// NOTE(laith): returns -1 when the connection has to be closed
+static s8 admiral_handle_packet(lmp_admiral_queue* queue, lmp_admiral_connection* connection, lmp_packet* packet) {
+    switch (packet->type) {
+        case LMP_TYPE_INIT:
+            if (packet->arg != LMP_ARG_INIT_INIT && packet->arg != LMP_ARG_INIT_SHM) {
+                return -1;
+            }
+
+            if (packet->arg == LMP_ARG_INIT_SHM) {
+                return admiral_share_connection(connection, packet->version);
+            }
+
+            return admiral_reply(connection, packet->version, LMP_TYPE_INIT, LMP_ARG_INIT_ACCEPT);
+        case LMP_TYPE_PING:
+            return admiral_reply(connection, packet->version, LMP_TYPE_PING, LMP_ARG_PING);
+        case LMP_TYPE_TERM:
+            return -1;
+        case LMP_TYPE_SEND:
+            break;
+        default:
+            return -1;
+    }
+
+    // NOTE(laith): once a stream starts, every SEND on this connection has to be its next fragment
+    // until the last one, so the fragments land in the queue the way they were sent, and a stream
+    // has to start at its beginning. a stream that fails partway closes the connection, which
+    // aborts what was queued of it
+    lmp_fragment fragment = {0};
+    s8 last = lmp_admiral_read_fragment(packet, &fragment);
+
+    if (connection->streaming ? last == -1 || fragment.stream_id != connection->streamId
+                              : last != -1 && fragment.offset != 0) {
+        LMP_LOG_ERROR("admiral", "Recieved bad stream fragment from [%s]", connection->endpoint->name);
+        return -1;
+    }
+
+    s8 p = lmp_admiral_add_packet_to_queue(queue, packet, connection->endpoint);
+    if (p == -1) {
+        lmp_packet sendPacket;
+
+        lmp_packet_init(&sendPacket);
+        sendPacket.version = packet->version;
+        lmp_admiral_invalidate_packet(&sendPacket);
+
+        if (admiral_queue_reply(connection, &sendPacket) == -1) {
+            LMP_LOG_WARN("admiral", "Could not send invalid response.");
+        }
+
+        LMP_LOG_ERROR("admiral", "Recieved invalid admiral packet from [%s]", connection->endpoint->name);
+        return connection->streaming ? -1 : 1;
+    }
+
+    connection->streaming = last == 0;
+    connection->streamId = fragment.stream_id;
+
+    if (last == 1) {
+        LMP_LOG_INFO("admiral", "Recieved and added stream [%u] of %u bytes from [%s] to queue",
+                     fragment.stream_id, fragment.total, connection->endpoint->name);
+    }
+
+    return 1;
+}
+
+// NOTE(laith): handles every whole packet sitting in the reader, returns -1 when that closed the
+// connection. with io_uring still writing the outbox and no room left behind it for a reply the
+// rest of the packets wait in the reader until the write completes
+static s8 admiral_handle_frames(admiral_network* network, lmp_admiral_connection* connection) {
+    for (;;) {
+        if (connection->outboxInFlight > 0
+            && ADMIRAL_OUTBOX_SIZE - connection->outboxLength < LMP_PACKET_HEADER_MAX_SIZE + 2) {
+            return 1;
+        }
+
+        lmp_packet packet;
+        lmp_result result;
+        lmp_result_init(&result);
+
+        lmp_error error = lmp_net_reader_next(&connection->reader, &packet, &result);
+        if (error == LMP_ERR_INCOMPLETE) {
+            return 1;
+        }
+
+        if (error != LMP_ERR_NONE) {
+            admiral_close_connection(network, connection, "bad packet");
+            return -1;
+        }
+
+        if (admiral_handle_packet(network->queue, connection, &packet) == -1) {
+            admiral_close_connection(network, connection, packet.type == LMP_TYPE_TERM ? "terminated" : "bad packet");
+            return -1;
+        }
+
+        connection->frameStarted = 0;
+    }
+}
+
+// NOTE(laith): sockets are non-blocking and edge triggered, so keep reading until the kernel has
+// nothing left, handling every whole packet after each read
+static void admiral_read_connection(admiral_network* network, lmp_admiral_connection* connection) {
+    for (;;) {
+        lmp_error error = lmp_net_reader_fill(&connection->reader);
+        if (error == LMP_ERR_INCOMPLETE) {
+            if (admiral_flush_connection(connection) == -1) {
+                admiral_close_connection(network, connection, "write failed");
+                return;
+            }
+
+            admiral_track_deadlines(connection, time(NULL));
+            return;
+        }
+
+        if (error == LMP_ERR_CLOSED) {
+            admiral_close_connection(network, connection, "closed by client");
+            return;
+        }
+
+        if (error != LMP_ERR_NONE) {
+            admiral_close_connection(network, connection, "read failed");
+            return;
+        }
+
+        if (admiral_handle_frames(network, connection) == -1) {
+            return;
+        }
+    }
+}
+
+// NOTE(laith): admiral only ever sleeps in its event loop, so after draining the ring it is left
+// parked and the service wakes the eventfd for the first bytes it writes after that
+static void admiral_read_shared(admiral_network* network, lmp_admiral_connection* connection) {
+    u8 buffer[LMP_PACKET_MAX_SIZE];
+
+    for (;;) {
+        size_t bytes = lmp_shm_read(&connection->shm, buffer, sizeof(buffer));
+        if (bytes == 0) {
+            if (lmp_shm_park(&connection->shm) == 0) {
+                break;
+            }
+            continue;
+        }
+
+        if (lmp_net_reader_push(&connection->reader, buffer, bytes) != LMP_ERR_NONE) {
+            admiral_close_connection(network, connection, "bad packet");
+            return;
+        }
+
+        if (admiral_handle_frames(network, connection) == -1) {
+            return;
+        }
+    }
+
+    if (admiral_flush_connection(connection) == -1) {
+        admiral_close_connection(network, connection, "write failed");
+        return;
+    }
+
+    admiral_track_deadlines(connection, time(NULL));
+}
+
+static const u8 datagramEmptyPayload[] = {LMP_PAYLOAD_EMPTY};
+
+// NOTE(laith): datagrams have no session and get no replies, except PINGs so a service can use them
+// as heartbeats. SENDs go into the queue like they would from a connection, anything else is
+// dropped, stream fragments included since datagrams can arrive out of order or not at all. the
+// sender is whoever its address says, which over udp anyone can claim to be. returns 1 when reply
+// was filled in for the caller to send back
+static s8 admiral_handle_datagram(admiral_network* network, lmp_net_datagram* datagram, lmp_packet* reply) {
+    const lmp_admiral_registry_entry* endpoint = NULL;
+    if (datagram->length > 0) {
+        endpoint = lmp_admiral_map_address_to_endpoint((struct sockaddr*)&datagram->address, datagram->addressLength);
+    }
+
+    lmp_packet packet;
+    lmp_result result;
+    lmp_result_init(&result);
+
+    if (endpoint) {
+        lmp_packet_deserialize(datagram->data, datagram->length, &packet, &result);
+    }
+
+    if (endpoint == NULL || result.error != LMP_ERR_NONE) {
+        network->droppedDatagrams++;
+        return 0;
+    }
+
+    if (packet.type == LMP_TYPE_PING) {
+        lmp_packet_init(reply);
+        reply->version = packet.version;
+        reply->type = LMP_TYPE_PING;
+        reply->arg = LMP_ARG_PING;
+        reply->payload = datagramEmptyPayload;
+        reply->payload_length = sizeof(datagramEmptyPayload);
+        return 1;
+    }
+
+    if (packet.type != LMP_TYPE_SEND || packet.arg != LMP_ARG_SEND
+        || lmp_admiral_add_packet_to_queue(network->queue, &packet, endpoint) == -1) {
+        network->droppedDatagrams++;
+    }
+
+    return 0;
+}
+
+// NOTE(laith): the socket is non-blocking, so this keeps taking LMP_NET_DATAGRAM_BATCH at a time
+// until a batch comes back short. the replies to a batch go out together before the next one is
+// read, since the next read overwrites the addresses they go back to
+static void admiral_read_datagrams(admiral_network* network) {
+    lmp_packet replies[LMP_NET_DATAGRAM_BATCH];
+    const lmp_net_datagram* requests[LMP_NET_DATAGRAM_BATCH];
+
+    for (;;) {
+        s32 n = lmp_net_recv_datagrams(network->datagramFd, network->datagrams, LMP_NET_DATAGRAM_BATCH);
+        if (n < 0) {
+            LMP_LOG_ERROR("admiral", "Failed to read datagrams");
+            return;
+        }
+
+        u32 replyCount = 0;
+        for (s32 i = 0; i < n; i++) {
+            if (admiral_handle_datagram(network, &network->datagrams[i], &replies[replyCount]) == 1) {
+                requests[replyCount++] = &network->datagrams[i];
+            }
+        }
+
+        if (replyCount > 0) {
+            lmp_result result;
+            lmp_net_reply_datagrams(network->datagramFd, replies, requests, replyCount, &result);
+        }
+
+        if (n < LMP_NET_DATAGRAM_BATCH) {
+            return;
+        }
+    }
+}
+
+// NOTE(laith): idle connections come off the front of the list, stalled frames and replies can be
+// anywhere in it so those take a walk over every open connection
+static void admiral_reap_connections(admiral_network* network, time_t now) {
+    while (network->oldest && now - network->oldest->lastActive > ADMIRAL_IDLE_TIMEOUT_SECONDS) {
+        admiral_close_connection(network, network->oldest, "idle");
+    }
+
+    lmp_admiral_connection* next;
+    for (lmp_admiral_connection* c = network->oldest; c; c = next) {
+        next = c->next;
+
+        if (c->frameStarted != 0 && now - c->frameStarted > ADMIRAL_FRAME_TIMEOUT_SECONDS) {
+            admiral_close_connection(network, c, "frame timed out");
+        } else if (c->writeStarted != 0 && now - c->writeStarted > ADMIRAL_SEND_TIMEOUT_SECONDS) {
+            admiral_close_connection(network, c, "not reading replies");
+        }
+    }
+}
+
+// NOTE(laith): runs every ADMIRAL_TIMER_INTERVAL_SECONDS. dropped datagrams are counted instead of
+// logged one by one, since a flood of them would otherwise turn into a flood of log lines
+static void admiral_tick(admiral_network* network, time_t now) {
+    admiral_reap_connections(network, now);
+
+    if (network->droppedDatagrams > 0) {
+        LMP_LOG_WARN("admiral", "Dropped %llu datagrams", (unsigned long long)network->droppedDatagrams);
+        network->droppedDatagrams = 0;
+    }
+}
+
+static s8 admiral_set_nonblocking(s32 fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return -1;
+    }
+
+    return 1;
+}
+
+// NOTE(laith): sets up a slot for a socket that was just accepted, returns NULL and closes the
+// socket when the client is turned away. local sockets came in over the unix listener and are
+// known by the user on the other end instead of their address
+static lmp_admiral_connection* admiral_open_connection(admiral_network* network, s32 connectionFd, u8 local) {
+    const lmp_admiral_registry_entry* endpoint = local
+        ? lmp_admiral_map_peer_to_endpoint(connectionFd)
+        : lmp_admiral_map_connection_to_endpoint(connectionFd);
+
+    if (endpoint == NULL) {
+        LMP_LOG_ERROR("admiral", "Bad client connected");
+        close(connectionFd);
+        return NULL;
+    }
+
+    lmp_admiral_connection* connection = network->available;
+    if (connection == NULL) {
+        LMP_LOG_ERROR("admiral", "Too many connections, turning client away");
+        close(connectionFd);
+        return NULL;
+    }
+
+    if (connection->reader.buffer == NULL) {
+        lmp_net_reader_init(&connection->reader, connectionFd, network->connectionArena);
+    }
+
+    if (connection->outbox == NULL) {
+        connection->outbox = arena_push(network->connectionArena, ADMIRAL_OUTBOX_SIZE);
+    }
+
+    if (admiral_set_nonblocking(connectionFd) == -1 || connection->outbox == NULL
+        || connection->reader.buffer == NULL) {
+        LMP_LOG_ERROR("admiral", "Could not set up connection");
+        close(connectionFd);
+        return NULL;
+    }
+
+    // NOTE(laith): replies are already batched per read, holding them back for Nagle only adds a
+    // round trip for a client waiting on its INIT or PING
+    if (!local) {
+        lmp_net_set_nodelay(connectionFd, 1);
+    }
+
+    network->available = connection->next;
+
+    connection->fd = connectionFd;
+    connection->endpoint = endpoint;
+    connection->outboxLength = 0;
+    connection->outboxInFlight = 0;
+    connection->frameStarted = 0;
+    connection->writeStarted = 0;
+    connection->streaming = 0;
+    connection->streamId = 0;
+    connection->local = local;
+    connection->shared = 0;
+    connection->sharedWatched = 0;
+    lmp_net_reader_reset(&connection->reader, connectionFd);
+
+    connection->lastActive = time(NULL);
+    admiral_idle_push(network, connection);
+
+    LMP_LOG_INFO("admiral", "Accepted %sconnection from [%s]", local ? "local " : "", endpoint->name);
+
+    return connection;
+}
+
+// NOTE(laith): returns 0 once there is nothing left to accept, otherwise 1 with the new connection
+// in out, which stays NULL when the client was turned away
+static s8 admiral_accept_connection(admiral_network* network, s32 listenerFd, lmp_admiral_connection** out) {
+    *out = NULL;
+
+    int connectionFd = accept(listenerFd, NULL, NULL);
+    if (connectionFd == -1) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+            return 1;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LMP_LOG_ERROR("admiral", "Failed to accept connection");
+        }
+        return 0;
+    }
+
+    *out = admiral_open_connection(network, connectionFd, listenerFd == network->unixFd);
+    return 1;
+}
+
+// NOTE(laith): pinning keeps a worker's connections, arenas and cache lines on one core. only
+// linux can pin a thread, elsewhere the scheduler places them
+static void admiral_pin_worker(const lmp_admiral_network_args* args) {
+    if (args->core < 0) {
+        return;
+    }
+
+#if OS_LINUX
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(args->core, &cpus);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        LMP_LOG_WARN("admiral", "Worker %u could not be pinned to core %d", args->worker, args->core);
+    }
+#endif
+}
+
+// NOTE(laith): a socket file left behind by a previous run is removed first. anyone may connect
+// since who they are is checked on accept. admiral keeps running on tcp alone if this fails
+static void admiral_listen_unix(admiral_network* network) {
+    struct sockaddr_un serverAddr = {0};
+    serverAddr.sun_family = AF_UNIX;
+    strncpy(serverAddr.sun_path, ADMIRAL_SOCKET_ADMIRAL, sizeof(serverAddr.sun_path) - 1);
+
+    int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketFd == -1) {
+        LMP_LOG_WARN("admiral", "Failed to create unix socket");
+        return;
+    }
+
+    unlink(ADMIRAL_SOCKET_ADMIRAL);
+
+    if (bind(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1
+        || chmod(ADMIRAL_SOCKET_ADMIRAL, 0666) == -1
+        || listen(socketFd, ADMIRAL_BACKLOG) == -1
+        || admiral_set_nonblocking(socketFd) == -1) {
+        LMP_LOG_WARN("admiral", "Failed to listen on " ADMIRAL_SOCKET_ADMIRAL ", local clients will use tcp");
+        close(socketFd);
+        return;
+    }
+
+    network->unixFd = socketFd;
+    LMP_LOG_INFO("admiral", "Listening on " ADMIRAL_SOCKET_ADMIRAL);
+}
+
+// NOTE(laith): the udp socket shares the admiral port, and with more than one worker the kernel
+// spreads datagrams over them by sender the same way it does connections
+static void admiral_listen_datagram(admiral_network* network, const lmp_admiral_network_args* args) {
+    int socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd == -1) {
+        LMP_LOG_WARN("admiral", "Failed to create datagram socket");
+        return;
+    }
+
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(ADMIRAL_PORT_ADMIRAL);
+    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int opt = 1;
+    if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1
+        || (args->reusePort && setsockopt(socketFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+        || bind(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1
+        || admiral_set_nonblocking(socketFd) == -1) {
+        LMP_LOG_WARN("admiral", "Failed to listen for datagrams, only taking connections");
+        close(socketFd);
+        return;
+    }
+
+    network->datagramFd = socketFd;
+}
+
+// NOTE(laith): room for every connection slot, their buffers and the datagram batch, about 30 MB
+static mem_arena* admiral_network_arena(void) {
+    return arena_create(KiB(8) + sizeof(lmp_net_datagram) * LMP_NET_DATAGRAM_BATCH
+        + ADMIRAL_MAX_CONNECTIONS * (sizeof(lmp_admiral_connection) + LMP_NET_READER_CAPACITY + ADMIRAL_OUTBOX_SIZE + 64));
+}
+
+static s8 admiral_network_init(admiral_network* network, const lmp_admiral_network_args* args) {
+    admiral_pin_worker(args);
+
+    network->queue = args->queue;
+    network->connectionArena = args->arena;
+    network->oldest = NULL;
+    network->newest = NULL;
+    network->unixFd = -1;
+    network->pollFd = -1;
+    network->datagramFd = -1;
+    network->droppedDatagrams = 0;
+    network->datagrams = arena_push(network->connectionArena, sizeof(lmp_net_datagram) * LMP_NET_DATAGRAM_BATCH);
+
+    network->connections = arena_push(network->connectionArena, sizeof(lmp_admiral_connection) * ADMIRAL_MAX_CONNECTIONS);
+    memset(network->connections, 0, sizeof(lmp_admiral_connection) * ADMIRAL_MAX_CONNECTIONS);
+    network->available = NULL;
+    for (s32 i = ADMIRAL_MAX_CONNECTIONS - 1; i >= 0; i--) {
+        network->connections[i].fd = -1;
+        network->connections[i].next = network->available;
+        network->available = &network->connections[i];
+    }
+
+    int socketFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketFd == -1) {
+        LMP_LOG_ERROR("admiral", "Failed to create socket");
+        return -1;
+    }
+
+    int opt = 1;
+    if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1
+        || (args->reusePort && setsockopt(socketFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)) {
+        LMP_LOG_ERROR("admiral", "Failed to set socket option");
+        close(socketFd);
+        return -1;
+    }
+
+    struct sockaddr_in serverAddr = {0};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(ADMIRAL_PORT_ADMIRAL);
+    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int b = bind(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr));
+    if (b == -1) {
+        LMP_LOG_ERROR("admiral", "Failed to bind to socket");
+        close(socketFd);
+        return -1;
+    }
+
+    int l = listen(socketFd, ADMIRAL_BACKLOG);
+    if (l == -1) {
+        LMP_LOG_ERROR("admiral", "Failed to bind to listen");
+        close(socketFd);
+        return -1;
+    }
+
+    if (admiral_set_nonblocking(socketFd) == -1) {
+        LMP_LOG_ERROR("admiral", "Failed to set socket option");
+        close(socketFd);
+        return -1;
+    }
+
+    network->socketFd = socketFd;
+
+    LMP_LOG_INFO("admiral", "Worker %u listening on %d", args->worker, ADMIRAL_PORT_ADMIRAL);
+
+    admiral_listen_datagram(network, args);
+
+    // NOTE(laith): unix sockets have no SO_REUSEPORT to spread them over workers, local traffic
+    // all goes through the first one
+    if (args->worker == 0) {
+        admiral_listen_unix(network);
+    }
+
+    return 1;
+}
+
+static void admiral_network_destroy(admiral_network* network) {
+    for (u32 i = 0; i < ADMIRAL_MAX_CONNECTIONS; i++) {
+        if (network->connections[i].fd != -1) {
+            close(network->connections[i].fd);
+        }
+    }
+
+    if (network->pollFd != -1) {
+        close(network->pollFd);
+    }
+
+    if (network->unixFd != -1) {
+        close(network->unixFd);
+    }
+
+    if (network->datagramFd != -1) {
+        close(network->datagramFd);
+    }
+
+    close(network->socketFd);
+    arena_destroy(network->connectionArena);
+}
+
+#if OS_LINUX
+
+// NOTE(laith): epoll_event.data.ptr is a connection, or one of these for the listeners and timer
+static u8 listenerTag;
+static u8 unixListenerTag;
+static u8 datagramTag;
+static u8 timerTag;
+
+static s8 admiral_epoll_add(s32 pollFd, s32 fd, u32 events, void* ptr) {
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.ptr = ptr;
+
+    return epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &event) == -1 ? -1 : 1;
+}
+
+// NOTE(laith): a connection that just moved into shm gets its eventfd watched under the same
+// pointer, and one read right away leaves its ring parked so the service starts waking admiral
+static void admiral_epoll_watch_shared(admiral_network* network, lmp_admiral_connection* connection) {
+    if (connection->fd == -1 || !connection->shared || connection->sharedWatched) {
+        return;
+    }
+
+    if (admiral_epoll_add(network->pollFd, connection->shm.eventFd, EPOLLIN | EPOLLET, connection) == -1) {
+        admiral_close_connection(network, connection, "could not watch shm");
+        return;
+    }
+
+    connection->sharedWatched = 1;
+    admiral_read_shared(network, connection);
+}
+
+static void admiral_epoll_run(admiral_network* network) {
+    network->pollFd = epoll_create1(0);
+    s32 timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+    struct itimerspec interval = {0};
+    interval.it_value.tv_sec = ADMIRAL_TIMER_INTERVAL_SECONDS;
+    interval.it_interval.tv_sec = ADMIRAL_TIMER_INTERVAL_SECONDS;
+
+    if (network->pollFd == -1 || timerFd == -1 || timerfd_settime(timerFd, 0, &interval, NULL) == -1
+        || admiral_epoll_add(network->pollFd, network->socketFd, EPOLLIN | EPOLLET, &listenerTag) == -1
+        || admiral_epoll_add(network->pollFd, timerFd, EPOLLIN, &timerTag) == -1
+        || (network->unixFd != -1
+            && admiral_epoll_add(network->pollFd, network->unixFd, EPOLLIN | EPOLLET, &unixListenerTag) == -1)
+        || (network->datagramFd != -1
+            && admiral_epoll_add(network->pollFd, network->datagramFd, EPOLLIN | EPOLLET, &datagramTag) == -1)) {
+        LMP_LOG_ERROR("admiral", "Failed to set up epoll");
+        if (timerFd != -1) {
+            close(timerFd);
+        }
+        return;
+    }
+
+    struct epoll_event events[ADMIRAL_EPOLL_EVENTS];
+
+    for (;;) {
+        int ready = epoll_wait(network->pollFd, events, ADMIRAL_EPOLL_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            LMP_LOG_ERROR("admiral", "Failed to wait on epoll");
+            break;
+        }
+
+        time_t now = time(NULL);
+
+        for (int i = 0; i < ready; i++) {
+            void* tag = events[i].data.ptr;
+
+            if (tag == &listenerTag || tag == &unixListenerTag) {
+                s32 listenerFd = tag == &listenerTag ? network->socketFd : network->unixFd;
+
+                lmp_admiral_connection* connection;
+                while (admiral_accept_connection(network, listenerFd, &connection) == 1) {
+                    if (connection && admiral_epoll_add(network->pollFd, connection->fd,
+                                                        EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, connection) == -1) {
+                        admiral_close_connection(network, connection, "could not watch socket");
+                    }
+                }
+                continue;
+            }
+
+            if (tag == &datagramTag) {
+                admiral_read_datagrams(network);
+                continue;
+            }
+
+            if (tag == &timerTag) {
+                u64 expirations;
+                while (read(timerFd, &expirations, sizeof(expirations)) > 0) {}
+                admiral_tick(network, now);
+                continue;
+            }
+
+            lmp_admiral_connection* connection = (lmp_admiral_connection*)tag;
+            if (connection->fd == -1) {
+                continue;
+            }
+
+            // NOTE(laith): a shared connection's socket only has a hang up left to report, anything
+            // else under its pointer came from the eventfd. what the service wrote before hanging
+            // up, like its TERM, is still read first
+            if (connection->shared) {
+                admiral_touch_connection(network, connection, now);
+                lmp_shm_drain(&connection->shm);
+                admiral_read_shared(network, connection);
+
+                if (connection->fd != -1 && events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    admiral_close_connection(network, connection, "closed by client");
+                }
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT && connection->outboxLength > 0) {
+                if (admiral_flush_connection(connection) == -1) {
+                    admiral_close_connection(network, connection, "write failed");
+                    continue;
+                }
+
+                admiral_track_deadlines(connection, now);
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                admiral_touch_connection(network, connection, now);
+                admiral_read_connection(network, connection);
+                admiral_epoll_watch_shared(network, connection);
+            }
+        }
+    }
+
+    close(timerFd);
+}
+
 void* network_loop(void* args) {
     lmp_admiral_network_args* a = (lmp_admiral_network_args*)args;
 
-    mem_arena* networkArena = arena_create(KiB(8));
+    admiral_network network;
+    if (admiral_network_init(&network, a) == -1) {
+        return NULL;
+    }
 
-    char logBuffer[255];
+    admiral_epoll_run(&network);
 
-    int socketFd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socketFd == -1) {
-        lmp_log_print("admiral", "Failed to create socket", LMP_PRINT_TYPE_ERROR);
-        return NULL;
+    admiral_network_destroy(&network);
+    return 0;
+}
+
+// NOTE(laith): the io_uring backend. accepts and recvs are multishot so each is armed once per
+// listener or connection, recvs land in a provided buffer ring instead of a buffer set aside per
+// connection, and replies are written out of the outboxes, which are registered with the ring
+typedef enum {
+    ADMIRAL_URING_ACCEPT = 1,
+    ADMIRAL_URING_RECV,
+    ADMIRAL_URING_WRITE,
+    ADMIRAL_URING_TIMER,
+    ADMIRAL_URING_NOTIFY,
+    ADMIRAL_URING_DATAGRAM,
+} admiral_uring_op;
+
+// NOTE(laith): a slot gets reused once its connection closes, the generation in the user data is
+// how completions still in flight for the old connection get told apart from the new one
+static u64 admiral_uring_data(admiral_uring_op op, lmp_admiral_connection* connection, u32 index) {
+    u32 generation = connection ? connection->generation & 0xFFFFFF : 0;
+    return (u64)op << 56 | (u64)generation << 32 | index;
+}
+
+typedef struct {
+    uring ring;
+    uring_buf_ring buffers;
+    u8 fixed;
+    struct __kernel_timespec interval;
+} admiral_uring;
+
+// NOTE(laith): the index of an accept is 1 for the unix listener and 0 for tcp
+static s8 admiral_uring_arm_accept(admiral_uring* u, admiral_network* network, u8 local) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+    if (sqe == NULL) {
+        return -1;
     }
 
-    int opt = 1;
-    if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-        lmp_log_print("admiral", "Failed to set socket option", LMP_PRINT_TYPE_ERROR);
-        close(socketFd);
-        return NULL;
+    uring_prep_accept_multishot(sqe, local ? network->unixFd : network->socketFd, SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                admiral_uring_data(ADMIRAL_URING_ACCEPT, NULL, local));
+    return 1;
+}
+
+static s8 admiral_uring_arm_recv(admiral_uring* u, admiral_network* network, lmp_admiral_connection* connection) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+    if (sqe == NULL) {
+        return -1;
     }
 
-    struct sockaddr_in serverAddr = {0};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(ADMIRAL_PORT_ADMIRAL);
-    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    u32 index = connection - network->connections;
+    uring_prep_recv_multishot(sqe, connection->fd, u->buffers.group,
+                              admiral_uring_data(ADMIRAL_URING_RECV, connection, index));
+    return 1;
+}
 
-    int b = bind(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr));
-    if (b == -1) {
-        lmp_log_print("admiral", "Failed to bind to socket", LMP_PRINT_TYPE_ERROR);
-        close(socketFd);
-        return NULL;
+// NOTE(laith): one read at a time on a shared connection's eventfd, armed again each time it fires
+static s8 admiral_uring_arm_notify(admiral_uring* u, admiral_network* network, lmp_admiral_connection* connection) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+    if (sqe == NULL) {
+        return -1;
     }
 
-    int l = listen(socketFd, ADMIRAL_BACKLOG);
-    if (l == -1) {
-        lmp_log_print("admiral", "Failed to bind to listen", LMP_PRINT_TYPE_ERROR);
-        close(socketFd);
-       return NULL;
+    u32 index = connection - network->connections;
+    uring_prep_read(sqe, connection->shm.eventFd, &connection->shm.wakeups, sizeof(connection->shm.wakeups),
+                    admiral_uring_data(ADMIRAL_URING_NOTIFY, connection, index));
+    return 1;
+}
+
+// NOTE(laith): datagrams are read with recvmmsg once the socket polls readable, a multishot recv
+// would hand them over one completion each
+static s8 admiral_uring_arm_datagram(admiral_uring* u, admiral_network* network) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    uring_prep_poll_multishot(sqe, network->datagramFd, POLLIN, admiral_uring_data(ADMIRAL_URING_DATAGRAM, NULL, 0));
+    return 1;
+}
+
+static s8 admiral_uring_arm_timer(admiral_uring* u) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+    if (sqe == NULL) {
+        return -1;
     }
 
-    snprintf(logBuffer, sizeof(logBuffer), "Listening on %d", ADMIRAL_PORT_ADMIRAL);
-    lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_INFO);
+    uring_prep_timeout(sqe, &u->interval, admiral_uring_data(ADMIRAL_URING_TIMER, NULL, 0));
+    return 1;
+}
 
-    for (;;) {
-        memset(logBuffer, 0, sizeof(logBuffer));
+// NOTE(laith): replies only come from INIT, PING and bad packets, so they are rare next to SENDs and
+// going straight to the socket costs less than a round trip through the ring. only what the socket
+// will not take right now gets written by io_uring, one write per connection at a time, and
+// whatever gets queued behind it goes out when it completes
+static s8 admiral_uring_write(admiral_uring* u, admiral_network* network, lmp_admiral_connection* connection) {
+    if (connection->shared) {
+        return admiral_flush_connection(connection);
+    }
 
-        struct sockaddr_in clientAddr;
-        socklen_t clientLength = sizeof(clientAddr);
+    if (connection->outboxInFlight > 0 || connection->outboxLength == 0) {
+        return 1;
+    }
 
-        int connectionFd = accept(socketFd, (struct sockaddr *)&clientAddr, &clientLength);
-        if (connectionFd == -1) {
-            lmp_log_print("admiral", "Failed to accept connection", LMP_PRINT_TYPE_ERROR);
-            continue;
+    if (admiral_flush_connection(connection) == -1) {
+        return -1;
+    }
+
+    if (connection->outboxLength == 0) {
+        return 1;
+    }
+
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    u32 index = connection - network->connections;
+    u64 data = admiral_uring_data(ADMIRAL_URING_WRITE, connection, index);
+
+    if (u->fixed) {
+        uring_prep_write_fixed(sqe, connection->fd, connection->outbox, connection->outboxLength, 0, data);
+    } else {
+        uring_prep_send(sqe, connection->fd, connection->outbox, connection->outboxLength, MSG_NOSIGNAL, data);
+    }
+
+    connection->outboxInFlight = connection->outboxLength;
+    return 1;
+}
+
+static void admiral_uring_recv(admiral_uring* u, admiral_network* network, lmp_admiral_connection* connection,
+                               struct io_uring_cqe* cqe, time_t now) {
+    // NOTE(laith): a shared connection may have left its TERM in the ring just before hanging up
+    if (cqe->res == 0) {
+        if (connection->shared) {
+            admiral_read_shared(network, connection);
         }
 
-        char* client = lmp_net_get_client(connectionFd, networkArena);
+        if (connection->fd != -1) {
+            admiral_close_connection(network, connection, "closed by client");
+        }
+        return;
+    }
 
-        if (client == NULL) {
-            lmp_log_print("admiral", "Could not parse client information", LMP_PRINT_TYPE_ERROR);
-            continue;
+    // NOTE(laith): every buffer was in use, the recv stopped and just has to be armed again
+    if (cqe->res == -ENOBUFS) {
+        if (admiral_uring_arm_recv(u, network, connection) == -1) {
+            admiral_close_connection(network, connection, "could not watch socket");
         }
+        return;
+    }
 
-        char* endpoint = lmp_admiral_map_client_to_endpoint(client);
-        if (endpoint == NULL) {
-            lmp_log_print("admiral", "Bad client connected", LMP_PRINT_TYPE_ERROR);
-            continue;
+    if (cqe->res < 0) {
+        admiral_close_connection(network, connection, "read failed");
+        return;
+    }
+
+    admiral_touch_connection(network, connection, now);
+
+    u8* data = uring_buf_ring_buffer(&u->buffers, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (lmp_net_reader_push(&connection->reader, data, cqe->res) != LMP_ERR_NONE) {
+        admiral_close_connection(network, connection, connection->outboxInFlight > 0 ? "not reading replies" : "bad packet");
+        return;
+    }
+
+    if (admiral_handle_frames(network, connection) == -1) {
+        return;
+    }
+
+    if (admiral_uring_write(u, network, connection) == -1) {
+        admiral_close_connection(network, connection, "write failed");
+        return;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && admiral_uring_arm_recv(u, network, connection) == -1) {
+        admiral_close_connection(network, connection, "could not watch socket");
+        return;
+    }
+
+    admiral_track_deadlines(connection, now);
+
+    if (connection->shared && !connection->sharedWatched) {
+        if (admiral_uring_arm_notify(u, network, connection) == -1) {
+            admiral_close_connection(network, connection, "could not watch shm");
+            return;
         }
 
-        snprintf(logBuffer, sizeof(logBuffer), "Accepted connection from [%s]", endpoint);
-        lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_INFO);
+        connection->sharedWatched = 1;
+        admiral_read_shared(network, connection);
+    }
+}
 
-        lmp_packet* readPacket = arena_push(networkArena, sizeof(lmp_packet));
-        lmp_packet sendPacket;
-        lmp_result result;
+static void admiral_uring_notified(admiral_uring* u, admiral_network* network, lmp_admiral_connection* connection,
+                                   struct io_uring_cqe* cqe, time_t now) {
+    if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+        admiral_close_connection(network, connection, "shm wakeup failed");
+        return;
+    }
 
-        lmp_packet_init(readPacket);
-        lmp_packet_init(&sendPacket);
-        lmp_result_init(&result);
-        u8 buffer[LMP_PACKET_MAX_SIZE];
+    admiral_touch_connection(network, connection, now);
+    admiral_read_shared(network, connection);
 
-        lmp_error error = lmp_net_recv_packet(connectionFd, buffer, sizeof(buffer), readPacket, &result);
-        if (error != LMP_ERR_NONE) {
-            close(connectionFd);
-            memset(logBuffer, 0, sizeof(logBuffer));
-            snprintf(logBuffer, sizeof(logBuffer), "Recieved bad packet from [%s]. Closing connection", endpoint);
-            lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_ERROR);
-            arena_clear(networkArena);
-            continue;
+    if (connection->fd != -1 && admiral_uring_arm_notify(u, network, connection) == -1) {
+        admiral_close_connection(network, connection, "could not watch shm");
+    }
+}
+
+static void admiral_uring_written(admiral_uring* u, admiral_network* network, lmp_admiral_connection* connection,
+                                  struct io_uring_cqe* cqe) {
+    if (cqe->res <= 0) {
+        admiral_close_connection(network, connection, "write failed");
+        return;
+    }
+
+    size_t sent = cqe->res;
+    memmove(connection->outbox, connection->outbox + sent, connection->outboxLength - sent);
+    connection->outboxLength -= sent;
+    connection->outboxInFlight = 0;
+    connection->writeStarted = 0;
+
+    if (admiral_handle_frames(network, connection) == -1) {
+        return;
+    }
+
+    if (admiral_uring_write(u, network, connection) == -1) {
+        admiral_close_connection(network, connection, "write failed");
+        return;
+    }
+
+    admiral_track_deadlines(connection, time(NULL));
+}
+
+static void admiral_uring_run(admiral_uring* u, admiral_network* network) {
+    if (admiral_uring_arm_accept(u, network, 0) == -1 || admiral_uring_arm_timer(u) == -1
+        || (network->unixFd != -1 && admiral_uring_arm_accept(u, network, 1) == -1)
+        || (network->datagramFd != -1 && admiral_uring_arm_datagram(u, network) == -1)) {
+        LMP_LOG_ERROR("admiral", "Failed to set up io_uring");
+        return;
+    }
+
+    for (;;) {
+        s32 r = uring_submit_and_wait(&u->ring, 1);
+        if (r < 0 && r != -EBUSY) {
+            LMP_LOG_ERROR("admiral", "Failed to wait on io_uring");
+            break;
         }
 
-        s8 p = lmp_admiral_add_packet_to_queue(a->queue, readPacket, endpoint);
-        if (p == -1) {
-            lmp_admiral_invalidate_packet(&sendPacket);
-            lmp_error send_error = lmp_net_send_packet(connectionFd, &sendPacket, &result);
+        time_t now = time(NULL);
+
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(&u->ring)) != NULL) {
+            admiral_uring_op op = cqe->user_data >> 56;
+            u32 generation = (cqe->user_data >> 32) & 0xFFFFFF;
+            u32 index = cqe->user_data & 0xFFFFFFFF;
+
+            if (op == ADMIRAL_URING_ACCEPT) {
+                lmp_admiral_connection* connection = cqe->res >= 0
+                    ? admiral_open_connection(network, cqe->res, index == 1) : NULL;
+                if (connection && admiral_uring_arm_recv(u, network, connection) == -1) {
+                    admiral_close_connection(network, connection, "could not watch socket");
+                }
+
+                if (!(cqe->flags & IORING_CQE_F_MORE) && admiral_uring_arm_accept(u, network, index == 1) == -1) {
+                    LMP_LOG_ERROR("admiral", "Failed to accept connection");
+                }
+            } else if (op == ADMIRAL_URING_DATAGRAM) {
+                admiral_read_datagrams(network);
+
+                if (!(cqe->flags & IORING_CQE_F_MORE) && admiral_uring_arm_datagram(u, network) == -1) {
+                    LMP_LOG_ERROR("admiral", "Failed to watch for datagrams");
+                }
+            } else if (op == ADMIRAL_URING_TIMER) {
+                admiral_tick(network, now);
+                admiral_uring_arm_timer(u);
+            } else {
+                lmp_admiral_connection* connection = &network->connections[index];
+                u8 current = connection->fd != -1 && (connection->generation & 0xFFFFFF) == generation;
 
-            if (send_error != LMP_ERR_NONE) {
-                lmp_log_print("admiral", "Could not send invalid response.", LMP_PRINT_TYPE_WARN);
+                if (current && op == ADMIRAL_URING_RECV) {
+                    admiral_uring_recv(u, network, connection, cqe, now);
+                } else if (current && op == ADMIRAL_URING_WRITE) {
+                    admiral_uring_written(u, network, connection, cqe);
+                } else if (current && op == ADMIRAL_URING_NOTIFY && connection->shared) {
+                    admiral_uring_notified(u, network, connection, cqe, now);
+                }
+
+                // NOTE(laith): the bytes were copied out above, or belonged to a connection that
+                // is gone, either way the buffer goes back to the kernel
+                if (cqe->flags & IORING_CQE_F_BUFFER) {
+                    uring_buf_ring_recycle(&u->buffers, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                }
             }
 
-            close(connectionFd);
-            memset(logBuffer, 0, sizeof(logBuffer));
-            snprintf(logBuffer, sizeof(logBuffer), "Recieved invalid admiral packet from [%s]. Closing connection", endpoint);
-            lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_ERROR);
-            arena_clear(networkArena);
-            continue;
+            uring_cqe_seen(&u->ring);
         }
+    }
+}
 
-        arena_clear(networkArena);
-        close(connectionFd);
+// NOTE(laith): needs a 6.1 kernel for the single issuer ring with deferred task work, which also
+// covers multishot accept and recv and buffer rings. anything older, or io_uring being switched
+// off, falls back to the epoll loop on the same listener
+void* network_loop_uring(void* args) {
+    lmp_admiral_network_args* a = (lmp_admiral_network_args*)args;
+    admiral_network network;
+    if (admiral_network_init(&network, a) == -1) {
+        return NULL;
+    }
+
+    admiral_uring u;
+    s32 r = uring_init(&u.ring, ADMIRAL_URING_ENTRIES, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN);
+    if (r == 0) {
+        r = uring_buf_ring_init(&u.ring, &u.buffers, 0, ADMIRAL_URING_BUFFERS, LMP_PACKET_MAX_SIZE);
+        if (r < 0) {
+            uring_destroy(&u.ring);
+        }
+    }
+
+    if (r < 0) {
+        LMP_LOG_WARN("admiral", "io_uring is not available (%s), falling back to epoll", strerror(-r));
+
+        admiral_epoll_run(&network);
+
+        admiral_network_destroy(&network);
+        return 0;
+    }
+
+    // NOTE(laith): every outbox gets handed out up front from one block so the whole thing can be
+    // registered as a single fixed buffer. pinning it can fail on a low memlock limit, replies
+    // then go out as plain sends
+    u8* outboxes = arena_push(network.connectionArena, (u64)ADMIRAL_MAX_CONNECTIONS * ADMIRAL_OUTBOX_SIZE);
+    for (u32 i = 0; i < ADMIRAL_MAX_CONNECTIONS; i++) {
+        network.connections[i].outbox = outboxes + (size_t)i * ADMIRAL_OUTBOX_SIZE;
+    }
+
+    struct iovec iov = {
+        .iov_base = outboxes,
+        .iov_len = (size_t)ADMIRAL_MAX_CONNECTIONS * ADMIRAL_OUTBOX_SIZE,
+    };
+
+    u.fixed = uring_register_buffers(&u.ring, &iov, 1) == 0;
+    if (!u.fixed) {
+        LMP_LOG_WARN("admiral", "Could not register outboxes with io_uring, using plain sends");
+    }
+
+    u.interval.tv_sec = ADMIRAL_TIMER_INTERVAL_SECONDS;
+    u.interval.tv_nsec = 0;
+
+    LMP_LOG_INFO("admiral", "Using the io_uring backend");
+    admiral_uring_run(&u, &network);
+
+    uring_buf_ring_destroy(&u.ring, &u.buffers);
+    uring_destroy(&u.ring);
+    admiral_network_destroy(&network);
+    return 0;
+}
+
+#else
+
+// NOTE(laith): portable fallback for building on mirage, level triggered poll over the same
+// connection handling as the epoll loop
+void* network_loop(void* args) {
+    lmp_admiral_network_args* a = (lmp_admiral_network_args*)args;
+
+    admiral_network network;
+    if (admiral_network_init(&network, a) == -1) {
+        return NULL;
+    }
+
+    struct pollfd* pollFds = arena_push(network.connectionArena, sizeof(struct pollfd) * (ADMIRAL_MAX_CONNECTIONS + 3));
+    lmp_admiral_connection** polled = arena_push(network.connectionArena, sizeof(lmp_admiral_connection*) * (ADMIRAL_MAX_CONNECTIONS + 3));
+
+    for (;;) {
+        nfds_t count = 0;
+
+        pollFds[count].fd = network.socketFd;
+        pollFds[count].events = POLLIN;
+        polled[count++] = NULL;
+
+        // NOTE(laith): with no unix listener or datagram socket the -1 fd is skipped by poll
+        pollFds[count].fd = network.unixFd;
+        pollFds[count].events = POLLIN;
+        polled[count++] = NULL;
+
+        pollFds[count].fd = network.datagramFd;
+        pollFds[count].events = POLLIN;
+        polled[count++] = NULL;
+
+        for (lmp_admiral_connection* c = network.oldest; c; c = c->next) {
+            pollFds[count].fd = c->fd;
+            pollFds[count].events = c->outboxLength > 0 ? POLLIN | POLLOUT : POLLIN;
+            polled[count++] = c;
+        }
+
+        int ready = poll(pollFds, count, ADMIRAL_TIMER_INTERVAL_SECONDS * 1000);
+        if (ready == -1 && errno != EINTR) {
+            LMP_LOG_ERROR("admiral", "Failed to poll connections");
+            break;
+        }
+
+        time_t now = time(NULL);
+
+        for (nfds_t i = 3; ready > 0 && i < count; i++) {
+            lmp_admiral_connection* connection = polled[i];
+
+            if (pollFds[i].revents & POLLOUT) {
+                if (admiral_flush_connection(connection) == -1) {
+                    admiral_close_connection(&network, connection, "write failed");
+                    continue;
+                }
+
+                admiral_track_deadlines(connection, now);
+            }
+
+            if (pollFds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                admiral_touch_connection(&network, connection, now);
+                admiral_read_connection(&network, connection);
+            }
+        }
+
+        for (nfds_t i = 0; ready > 0 && i < 2; i++) {
+            if (pollFds[i].revents & POLLIN) {
+                lmp_admiral_connection* connection;
+                while (admiral_accept_connection(&network, pollFds[i].fd, &connection) == 1) {}
+            }
+        }
+
+        if (ready > 0 && (pollFds[2].revents & POLLIN)) {
+            admiral_read_datagrams(&network);
+        }
+
+        admiral_tick(&network, now);
     }
 
-    arena_destroy(networkArena);
-    close(socketFd);
+    admiral_network_destroy(&network);
     return 0;
 }
 
+#endif
+
 void* admiral_loop(void* args) {
     lmp_admiral_admiral_args* a = (lmp_admiral_admiral_args*)args;
 
-    char logBuffer[255];
+    lmp_admiral_scheduler scheduler;
+    lmp_admiral_scheduler_init(&scheduler, a->queue);
+    s8 replaying = 0;
 
     for (;;) {
-        memset(logBuffer, 0, sizeof(logBuffer));
-        lmp_admiral_message* msg = lmp_admiral_queue_dequeue(a->queue);
+        // NOTE(laith): whatever is waiting in the queue moves into the lanes before anything is
+        // picked, so the scheduler weighs all of it. the thread only sleeps while every lane is
+        // empty or sitting out a retry and the log has nothing it can replay, and a network thread
+        // enqueueing something wakes it right away
+        s32 timeout = lmp_admiral_scheduler_timeout(&scheduler, lmp_net_now_ms());
+        if (timeout != 0 && !replaying && lmp_admiral_queue_park(a->queue) == 0) {
+            struct pollfd fd = {a->queue->waitFd, POLLIN, 0};
+            if (poll(&fd, 1, timeout) > 0) {
+                lmp_admiral_queue_drain(a->queue);
+            }
+        }
 
+        u64 now = lmp_net_now_ms();
+        replaying = lmp_admiral_scheduler_fill(&scheduler, now);
+
+        lmp_admiral_message* msg = lmp_admiral_scheduler_next(&scheduler, now);
         if (msg == NULL) {
-            snprintf(logBuffer, sizeof(logBuffer),"No message in the queue. Retrying in %d seconds", ADMIRAL_QUEUE_READ_RETRY_SECONDS);
-            lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_WARN);
-            sleep(ADMIRAL_QUEUE_READ_RETRY_SECONDS);
             continue;
         }
 
-        char* destinationName = lmp_admiral_map_id_to_endpoint(msg->destinationId);
-        char* senderName = lmp_admiral_map_id_to_endpoint(msg->senderId);
+        const char* destinationName = lmp_admiral_map_id_to_endpoint(msg->destinationId)->name;
+        const char* senderName = lmp_admiral_map_id_to_endpoint(msg->senderId)->name;
 
-        lmp_admiral_sanitize_message(msg);
+        lmp_fragment fragment;
+        s8 stream = msg->fragments > 1 && lmp_admiral_read_fragment(&msg->packet, &fragment) != -1;
 
-        snprintf(logBuffer, sizeof(logBuffer), "Forwarding message to [%s] from [%s]",
-                 destinationName, senderName);
+        u8 destination = msg->destinationId;
+        s8 forwarded = 1;
 
-        lmp_log_print("admiral", logBuffer, LMP_PRINT_TYPE_INFO);
-    }
+        // NOTE(laith): messages for admiral itself stop here, there is nowhere to forward them
+        if (destination != ADMIRAL) {
+            // NOTE(laith): every unit gets a connection of its own, closed as soon as it went out
+            s32 forwardFd = lmp_admiral_connect_to_endpoint(destination);
+            if (forwardFd == -1) {
+                lmp_admiral_scheduler_defer(&scheduler, destination, now);
+                LMP_LOG_WARN("admiral", "Could not reach [%s], retrying in %u ms", destinationName,
+                             scheduler.backoff[destination]);
+                continue;
+            }
+
+            // NOTE(laith): a stream goes out back to back over one connection. the routing bytes
+            // are dropped from a copy, the messages themselves stay as they were queued. over tcp
+            // it is corked so the fragments fill whole segments and uncorking pushes out the rest,
+            // a unix socket just turns the cork down
+            if (msg->fragments > 1) {
+                lmp_net_set_cork(forwardFd, 1);
+            }
+
+            lmp_admiral_message* next = msg;
+            for (u32 i = 0; i < msg->fragments && forwarded == 1; i++, next = next->next) {
+                lmp_admiral_message sanitized = *next;
+                lmp_admiral_sanitize_message(&sanitized);
+                forwarded = lmp_admiral_forward_message(forwardFd, &sanitized);
+            }
+
+            if (msg->fragments > 1) {
+                lmp_net_set_cork(forwardFd, 0);
+            }
+
+            close(forwardFd);
+        }
+
+        // NOTE(laith): nothing counts as delivered until it went out. a failed unit stays at the
+        // front of its lane and goes out again whole once the destination is retried
+        if (forwarded == -1) {
+            lmp_admiral_scheduler_defer(&scheduler, destination, now);
+            LMP_LOG_ERROR("admiral", "Could not forward message to [%s] from [%s], retrying in %u ms", destinationName,
+                          senderName, scheduler.backoff[destination]);
+            continue;
+        }
+
+        // NOTE(laith): the payloads were sent straight out of their slots, which go back to the
+        // producers now that nothing reads them anymore
+        lmp_admiral_scheduler_done(&scheduler, msg);
+
+        u32 fragments = msg->fragments;
+        for (u32 i = 0; i < fragments; i++) {
+            lmp_admiral_message* next = msg->next;
+            lmp_admiral_queue_release(a->queue, msg);
+            msg = next;
+        }
 
-    // TODO(laith): send the net packet, for now lets log to test
-    // use the new endpoint macros to connect to the IP and port to send
+        if (stream) {
+            LMP_LOG_INFO("admiral", "Forwarding stream [%u] of %u bytes to [%s] from [%s]",
+                         fragment.stream_id, fragment.total, destinationName, senderName);
+        } else {
+            LMP_LOG_INFO("admiral", "Forwarding message to [%s] from [%s]", destinationName, senderName);
+        }
+    }
 
     return 0;
 }
 
-int main(void) {
+// NOTE(laith): admiral [-b epoll|uring] [-w workers] [-c config] [-q capacity] [-s spill] [-d log directory]. the backend only changes how the network
+// threads talk to the kernel, and every worker parses and routes its own connections, so the
+// admiral thread only ever sees messages that are ready to forward
+int main(int argc, char** argv) {
+    void* (*networkLoop)(void*) = network_loop;
+    u32 workers = 1;
+    const char* configPath = ADMIRAL_CONFIG_PATH;
+    u32 capacity = ADMIRAL_QUEUE_CAPACITY;
+    const char* spillPath = NULL;
+    const char* walDirectory = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:w:c:q:s:d:")) != -1) {
+        if (opt == 'b' && strcmp(optarg, "epoll") == 0) {
+            networkLoop = network_loop;
+        } else if (opt == 'b' && strcmp(optarg, "uring") == 0) {
+#if OS_LINUX
+            networkLoop = network_loop_uring;
+#else
+            LMP_LOG_WARN("admiral", "io_uring is only on linux, using poll");
+#endif
+        } else if (opt == 'w' && atoi(optarg) >= 1 && atoi(optarg) <= ADMIRAL_MAX_WORKERS) {
+            workers = atoi(optarg);
+        } else if (opt == 'c') {
+            configPath = optarg;
+        } else if (opt == 'q' && atol(optarg) >= 1 && atol(optarg) <= ADMIRAL_QUEUE_MAX_CAPACITY) {
+            capacity = (u32)atol(optarg);
+        } else if (opt == 's') {
+            spillPath = optarg;
+        } else if (opt == 'd') {
+            walDirectory = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-b epoll|uring] [-w 1-%d] [-c config] [-q 1-%u] [-s spill] [-d log directory]\n",
+                    argv[0], ADMIRAL_MAX_WORKERS, ADMIRAL_QUEUE_MAX_CAPACITY);
+            return 1;
+        }
+    }
+
+    s8 loaded = lmp_admiral_registry_load(configPath);
+    if (loaded == -1) {
+        LMP_LOG_ERROR("admiral", "Could not load endpoints from %s", configPath);
+        return 1;
+    }
+
+    if (loaded == 0) {
+        LMP_LOG_WARN("admiral", "No config at %s, using the built in endpoints", configPath);
+    }
+
+    // NOTE(laith): a client hanging up mid reply should close its connection, not admiral
+    signal(SIGPIPE, SIG_IGN);
+
     lmp_admiral_queue queue;
-    lmp_admiral_queue_init(&queue, ADMIRAL_QUEUE_CAPACITY);
+    if (lmp_admiral_queue_init(&queue, capacity, spillPath) == -1) {
+        LMP_LOG_ERROR("admiral", "Could not create the message queue%s%s", spillPath ? " spilling to " : "",
+                      spillPath ? spillPath : "");
+        return 1;
+    }
 
-    lmp_admiral_network_args networkArgs = {
-        .queue = &queue,
-    };
+    // NOTE(laith): the forwarding thread replays what was left over from the last run as the queue
+    // makes room, and anything new waits in the log behind it until it has caught up
+    lmp_admiral_wal wal;
+    if (walDirectory) {
+        s64 waiting = lmp_admiral_wal_open(&wal, walDirectory, &queue);
+        if (waiting == -1) {
+            LMP_LOG_ERROR("admiral", "Could not open the write-ahead log in %s", walDirectory);
+            return 1;
+        }
+
+        if (waiting > 0) {
+            LMP_LOG_INFO("admiral", "Replaying %lld messages from %s", (long long)waiting, walDirectory);
+        }
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        cores = 1;
+    }
+
+    lmp_admiral_network_args networkArgs[ADMIRAL_MAX_WORKERS];
+    pthread_t networkThreads[ADMIRAL_MAX_WORKERS];
 
-    pthread_t networkThread;
+    for (u32 i = 0; i < workers; i++) {
+        networkArgs[i].queue = &queue;
+        networkArgs[i].worker = i;
+        networkArgs[i].core = workers > 1 ? (s32)(i % cores) : -1;
+        networkArgs[i].reusePort = workers > 1;
+        networkArgs[i].arena = admiral_network_arena();
+
+        if (networkArgs[i].arena == NULL) {
+            LMP_LOG_ERROR("admiral", "Could not allocate connections for %u network workers", workers);
+            return 1;
+        }
+    }
 
-    pthread_create(&networkThread, NULL, network_loop, (void*)&networkArgs);
+    for (u32 i = 0; i < workers; i++) {
+        pthread_create(&networkThreads[i], NULL, networkLoop, (void*)&networkArgs[i]);
+    }
 
     lmp_admiral_admiral_args admiralArgs = {
         .queue = &queue,
@@ -197,9 +1612,10 @@ int main(void) {
 
     pthread_create(&admiralThread, NULL, admiral_loop, (void*)&admiralArgs);
 
-    pthread_join(networkThread, NULL);
+    for (u32 i = 0; i < workers; i++) {
+        pthread_join(networkThreads[i], NULL);
+    }
     pthread_join(admiralThread, NULL);
 
     return 0;
 }
-
@@ -16,11 +16,7 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <time.h>
-#include <unistd.h>
 
 #include "../../lib/c/lt_arena.h"
 #include "../../lib/c/lt_base.h"
@@ -33,17 +29,14 @@ s8 populate_scheduler(mem_arena* arena, u8** table) {
     FILE* f = fopen(CONFIG_PATH, "r");
 
     if (f == NULL) {
-        lmp_log_print("echo", "Error opening config file.", LMP_PRINT_TYPE_ERROR);
+        LMP_LOG_ERROR("echo", "Error opening config file.");
         return -1;
     }
 
     int hour, minute, second;
     u8 payload[LMP_PACKET_PAYLOAD_MAX_SIZE] = {0};
-    char logBuffer[255];
 
     for (;;) {
-        memset(logBuffer, 0, sizeof(logBuffer));
-
         int s = fscanf(f, "%d:%d:%d %s", &hour, &minute, &second, payload);
         if (s == -1) {
             break;
@@ -53,11 +46,9 @@ s8 populate_scheduler(mem_arena* arena, u8** table) {
         memcpy(allocatedPayload, payload, LMP_PACKET_PAYLOAD_MAX_SIZE);
         u32 destination = (hour * 24) + (minute * 60) + (second * 60);
 
-        snprintf(logBuffer, sizeof(logBuffer), "Scheduled job for %02d:%02d:%02d", hour, minute, second);
-
         table[destination] = allocatedPayload;
 
-        lmp_log_print("echo", logBuffer, LMP_PRINT_TYPE_INFO);
+        LMP_LOG_INFO("echo", "Scheduled job for %02d:%02d:%02d", hour, minute, second);
     }
 
     fclose(f);
@@ -66,6 +57,10 @@ s8 populate_scheduler(mem_arena* arena, u8** table) {
 
 int main(void) {
     mem_arena* arena = arena_create(KiB(10));
+    if (arena == NULL) {
+        return 1;
+    }
+
     u8* table[86400] = {0};
 
     populate_scheduler(arena, table);
@@ -79,44 +74,6 @@ int main(void) {
         if (table[24*time_info->tm_hour + 60*time_info->tm_min + 60*time_info->tm_sec] != NULL && action != timestamp) {
             action = timestamp;
 
-            int socketFd = socket(AF_INET, SOCK_STREAM, 0);
-            if (socketFd == -1) {
-                lmp_log_print("echo", "Failed to create socket", LMP_PRINT_TYPE_ERROR);
-                return 1;
-            }
-
-            int opt = 1;
-            int s = setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-            if (s == -1) {
-                lmp_log_print("echo", "Failed to set socket option", LMP_PRINT_TYPE_ERROR);
-                close(socketFd);
-                return 1;
-            }
-
-            struct sockaddr_in localAddr = {0};
-            localAddr.sin_family = AF_INET;
-            localAddr.sin_port = htons(ADMIRAL_PORT_SCHEDULER);
-            localAddr.sin_addr.s_addr = INADDR_ANY;
-
-            int b = bind(socketFd, (struct sockaddr*)&localAddr, sizeof(localAddr));
-            if (b == -1) {
-                lmp_log_print("echo", "Failed to bind to port", LMP_PRINT_TYPE_ERROR);
-                close(socketFd);
-                continue;
-            }
-
-            struct sockaddr_in serverAddr = {0};
-            serverAddr.sin_family = AF_INET;
-            serverAddr.sin_port = htons(ADMIRAL_PORT_ADMIRAL);
-            serverAddr.sin_addr.s_addr = inet_addr(ADMIRAL_HOST_ADMIRAL);
-
-            int c = connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr));
-            if (c == -1) {
-                lmp_log_print("echo", "Could not connect to admiral", LMP_PRINT_TYPE_ERROR);
-                close(socketFd);
-                continue;
-            }
-
             lmp_packet sendPacket = {0};
             lmp_result result = {0};
             lmp_packet_init(&sendPacket);
@@ -131,13 +88,11 @@ int main(void) {
 
             sendPacket.payload_length = payloadLength;
 
-            lmp_net_send_packet(socketFd, &sendPacket, &result);
+            lmp_net_send_packet_to_admiral("scheduler", &sendPacket, &result);
 
             if (result.error != LMP_ERR_NONE) {
-                lmp_log_print("echo", "Failed to serialize and send packet to admiral", LMP_PRINT_TYPE_ERROR);
+                LMP_LOG_ERROR("echo", "Failed to serialize and send packet to admiral");
             }
-
-            close(socketFd);
         }
     }
 
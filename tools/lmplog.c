@@ -0,0 +1,140 @@
+/*  lmplog.c - Decoder for binary LIONS Middleware Protocol logs
+    Copyright (C) 2026 splatte.dev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+// ===============================================================
+// Turns a log written with LMP_LOG_FORMAT=binary back into the
+// lines liblmp would have printed:
+//   LMP_LOG_FORMAT=binary admiral 2> admiral.lmplog
+//   ./lmplog admiral.lmplog
+// ===============================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/c/lt_arena.h"
+#include "../lib/c/lt_base.h"
+#include "../lib/c/lmp.h"
+#include "../lib/c/liblmp.h"
+
+#define LMPLOG_STRINGS 65536
+
+static char* strings[LMPLOG_STRINGS];
+
+static s8 read_exact(FILE* f, void* buffer, size_t length) {
+    return fread(buffer, 1, length, f) == length ? 1 : -1;
+}
+
+// NOTE(laith): 'S' <u16 id> <u16 length> <bytes>
+static s8 read_string(FILE* f) {
+    u16 id, length;
+    if (read_exact(f, &id, sizeof(id)) == -1 || read_exact(f, &length, sizeof(length)) == -1) {
+        return -1;
+    }
+
+    char* string = malloc(length + 1);
+    if (string == NULL || read_exact(f, string, length) == -1) {
+        free(string);
+        return -1;
+    }
+
+    string[length] = '\0';
+    free(strings[id]);
+    strings[id] = string;
+
+    return 1;
+}
+
+// NOTE(laith): 'R' <u64 timestamp> <u8 level> <u16 service> <u16 format> <u8 count> <count types>
+// then each argument, a u8 length and its bytes for strings and a u64 for everything else
+static s8 read_record(FILE* f, lmp_log_record* record) {
+    u8 header[14];
+    if (read_exact(f, header, sizeof(header)) == -1) {
+        return -1;
+    }
+
+    u16 service, format;
+    memcpy(&record->timestamp, header, sizeof(record->timestamp));
+    record->level = header[8];
+    memcpy(&service, header + 9, sizeof(service));
+    memcpy(&format, header + 11, sizeof(format));
+    record->argCount = header[13];
+
+    if (record->argCount > LMP_LOG_RECORD_ARGS || strings[service] == NULL || strings[format] == NULL
+        || read_exact(f, record->argTypes, record->argCount) == -1) {
+        return -1;
+    }
+
+    record->service = strings[service];
+    record->format = strings[format];
+
+    size_t used = 0;
+    for (u8 i = 0; i < record->argCount; i++) {
+        if (record->argTypes[i] != LMP_LOG_ARG_STRING) {
+            if (read_exact(f, &record->args[i], sizeof(record->args[i])) == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        u8 length;
+        if (read_exact(f, &length, sizeof(length)) == -1 || used + length + 1 > sizeof(record->strings)
+            || read_exact(f, record->strings + used, length) == -1) {
+            return -1;
+        }
+
+        record->strings[used + length] = '\0';
+        record->args[i] = used;
+        used += length + 1;
+    }
+
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    FILE* f = stdin;
+    if (argc > 1 && (f = fopen(argv[1], "rb")) == NULL) {
+        fprintf(stderr, "could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    char magic[sizeof(LMP_LOG_BINARY_MAGIC) - 1];
+    if (read_exact(f, magic, sizeof(magic)) == -1 || memcmp(magic, LMP_LOG_BINARY_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "not a binary lmp log\n");
+        return 1;
+    }
+
+    char line[LMP_LOG_LINE_SIZE];
+    int tag;
+
+    while ((tag = fgetc(f)) != EOF) {
+        lmp_log_record record;
+
+        if (tag == 'S' && read_string(f) == 1) {
+            continue;
+        }
+
+        if (tag == 'R' && read_record(f, &record) == 1) {
+            fwrite(line, 1, lmp_log_format_record(&record, line, sizeof(line)), stdout);
+            continue;
+        }
+
+        fprintf(stderr, "log is cut short or corrupt at byte %ld\n", ftell(f));
+        return 1;
+    }
+
+    return 0;
+}